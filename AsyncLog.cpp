@@ -0,0 +1,82 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "AsyncLog.h"
+#include "Logging.h"
+
+AsyncLog::AsyncLog(Print &target, size_t size) :
+  AL_buffer(size),
+  AL_target(target),
+  AL_task(nullptr),
+  AL_running(false),
+  AL_stopped(false),
+  AL_dropped(0) {
+}
+
+AsyncLog::~AsyncLog() {
+  end();
+}
+
+// begin: start the task, pinned to the requested core
+bool AsyncLog::begin(UBaseType_t priority, BaseType_t core, uint32_t stackSize) {
+  // Already running?
+  if (AL_task) return true;
+  AL_running = true;
+  AL_stopped = false;
+  if (xTaskCreatePinnedToCore(task, "AsyncLog", stackSize, this, priority, &AL_task, core) != pdPASS) {
+    AL_task = nullptr;
+    AL_running = false;
+    return false;
+  }
+  return true;
+}
+
+// end: let the task do a last drain and terminate
+void AsyncLog::end() {
+  if (!AL_task) return;
+  AL_running = false;
+  xTaskNotifyGive(AL_task);
+  // Wait for the task to finish
+  while (!AL_stopped) delay(1);
+  AL_task = nullptr;
+}
+
+// write: a single character
+size_t AsyncLog::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+// write: copy output into the buffer and wake up the task
+size_t AsyncLog::write(const uint8_t *buffer, size_t size) {
+  bool ok;
+  {
+    // Several tasks may write - serialize them as the buffer has a single producer side only
+    LOCK_GUARD(lock, AL_lock);
+    ok = AL_buffer.push_back(buffer, size);
+    if (!ok) AL_dropped += size;
+  }
+  if (ok && AL_task) xTaskNotifyGive(AL_task);
+  return size;
+}
+
+// drain: hand over all buffered output to the target in contiguous chunks
+void AsyncLog::drain() {
+  AL_buffer.drainTo(AL_target);
+#ifdef LOG_DEFERRED
+  logDrain();
+#endif
+}
+
+// task: wait for new output - or the period to elapse for deferred records - and write it
+void AsyncLog::task(void *parm) {
+  AsyncLog *self = static_cast<AsyncLog *>(parm);
+  while (self->AL_running) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(AL_PERIOD));
+    self->drain();
+  }
+  // Task was stopped. One last time to get the remainder
+  self->drain();
+  self->AL_stopped = true;
+  vTaskDelete(NULL);
+}
@@ -0,0 +1,63 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+
+#ifndef _ASYNCLOG_H
+#define _ASYNCLOG_H
+// Include Arduino.h to make Print and Serial known
+#include <Arduino.h>
+#include "RingBuf.h"
+
+#if !defined(ESP32)
+#error "AsyncLog requires an ESP32 to run."
+#endif
+
+// Defaults for the background task
+#define AL_PRIORITY 1          // Task priority - below the Arduino loop and the network tasks
+#define AL_CORE 0              // Core the task is pinned to
+#define AL_STACK 3072          // Task stack size
+#define AL_PERIOD 50           // Milliseconds the task will wait for new output at most
+
+// AsyncLog: a Print decoupling the writers from a slow output device.
+// write() only copies the output into a lock-free SPSC buffer and wakes up a background task. 
+// This task is the only one writing to the target, so f.i. a Modbus task will never stall
+// on the UART. Output not fitting into the buffer is dropped instead of blocking the writer.
+// With LOG_DEFERRED the task will format the deferred log records and send them to the log devices as well.
+class AsyncLog : public Print {
+public:
+  // Constructor: target is the Print to be written to, size the buffer size in bytes
+  AsyncLog(Print &target, size_t size = 2048);
+
+  // Destructor: stop the task
+  ~AsyncLog();
+
+  // begin: start the background task
+  bool begin(UBaseType_t priority = AL_PRIORITY, BaseType_t core = AL_CORE, uint32_t stackSize = AL_STACK);
+
+  // end: stop the background task. Output still in the buffer will be written first.
+  void end();
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+
+  // getDropped: number of bytes that did not fit into the buffer
+  inline uint32_t getDropped() { return AL_dropped; }
+
+protected:
+  // AL_buffer is written under AL_lock by any number of tasks, but read by the task only
+  RingBuf<uint8_t, RB_SPSC> AL_buffer;
+  RB_Lock AL_lock;
+  Print &AL_target;
+  TaskHandle_t AL_task;
+  std::atomic<bool> AL_running;     // Cleared by end() to stop the task
+  std::atomic<bool> AL_stopped;     // Set by the task when it is done
+  uint32_t AL_dropped;
+
+  // drain: write all buffered output to the target. Only called by the task.
+  void drain();
+  // task: the background task's function
+  static void task(void *parm);
+};
+
+#endif
@@ -2,11 +2,18 @@
 // Copyright 2020 by miq1@gmx.de
 
 #include "Blinker.h"
+#include "Instrument.h"
+#include "Tick.h"
 
 // Constructor: takes GPIO of LED to handle
 Blinker::Blinker(uint8_t port, bool onState) :
   B_port(port),
-  B_onState(onState) {
+  B_onState(onState)
+#if defined(ESP32)
+  , B_rmtChannel(-1),
+  B_rmtActive(false)
+#endif
+  {
   pinMode(port, OUTPUT);
   stop();
 }
@@ -23,12 +30,21 @@ uint32_t Blinker::start(uint16_t pattern, uint32_t interval) {
   }
   B_pWork = B_pattern;
   B_counter = 0;
-  B_lastTick = millis();
+  B_lastTick = Tick::now();
+#if defined(ESP32)
+  // Let the RMT do it, if we may
+  if (B_rmtChannel >= 0) B_rmtActive = startRMT();
+#endif
   return B_lastTick + B_interval;
 }
 
 // stop: stop blinking
 void Blinker::stop() {
+#if defined(ESP32)
+  // The RMT will return to its idle level, which is OFF
+  if (B_rmtActive) rmt_tx_stop((rmt_channel_t)B_rmtChannel);
+  B_rmtActive = false;
+#endif
   B_lastTick = 0;
   B_interval = 0;
   B_pattern = 0;
@@ -37,11 +53,17 @@ void Blinker::stop() {
 }
 
 // update: check if the blinking pattern needs to be advanced a step
-void Blinker::update() {
+uint32_t Blinker::update() {
+  PROF_SCOPE("Blinker::update");
+#if defined(ESP32)
+  // Nothing to do if the RMT is playing the pattern
+  if (B_rmtActive) return nextDue();
+#endif
   // Do we have a valid interval?
   if (B_interval) {
     // Yes. Has it passed?
-    if (millis() - B_lastTick > B_interval) {
+    uint32_t now = Tick::now();
+    if (now - B_lastTick > B_interval) {
       // Yes. get the current state of the LED pin
       bool state = digitalRead(B_port);
       // Does the pattern require an ON?
@@ -60,7 +82,87 @@ void Blinker::update() {
         B_counter = 0;
         B_pWork = B_pattern;
       }
-      B_lastTick = millis();
+      B_lastTick = now;
     }
   }
+  return nextDue();
 }
+
+// nextDue: the next step will be taken once B_interval has passed completely
+uint32_t Blinker::nextDue() {
+#if defined(ESP32)
+  if (B_rmtActive) return Tick::now() + BLINKER_IDLE;
+#endif
+  if (B_interval) return B_lastTick + B_interval + 1;
+  return Tick::now() + BLINKER_IDLE;
+}
+
+#if defined(ESP32)
+// useRMT: set up the RMT channel to drive the LED GPIO in loop mode
+bool Blinker::useRMT(rmt_channel_t channel) {
+  if (B_rmtChannel >= 0) return B_rmtChannel == channel;
+  rmt_config_t cfg = RMT_DEFAULT_CONFIG_TX((gpio_num_t)B_port, channel);
+  cfg.clk_div = BLINKER_RMTDIV;
+  cfg.flags = RMT_CHANNEL_FLAGS_AWARE_DFS;    // REF_TICK clock, independent of the APB frequency
+  cfg.tx_config.loop_en = true;
+  cfg.tx_config.idle_output_en = true;
+  cfg.tx_config.idle_level = B_onState ? RMT_IDLE_LEVEL_LOW : RMT_IDLE_LEVEL_HIGH;
+  if (rmt_config(&cfg) != ESP_OK) return false;
+  if (rmt_driver_install(channel, 0, 0) != ESP_OK) return false;
+  B_rmtChannel = channel;
+  // Is a pattern running already? Take it over
+  if (B_interval) B_rmtActive = startRMT();
+  return true;
+}
+
+// startRMT: convert the pattern into runs of equal bits and have them played in a loop.
+// Each RMT item holds two runs. A run longer than an item's 15-bit duration is split.
+bool Blinker::startRMT() {
+  const uint32_t MAXDURATION(32767);
+  const uint8_t MAXITEMS(63);           // One of the 64 items of a memory block is the end marker
+  rmt_item32_t items[MAXITEMS];
+  uint8_t halves = 0;
+
+  rmt_tx_stop((rmt_channel_t)B_rmtChannel);
+  // Give the GPIO back for update(), in case we cannot use the RMT
+  pinMode(B_port, OUTPUT);
+  if (!B_pLength) return false;
+
+  uint8_t bit = 0;
+  while (bit < B_pLength) {
+    // Find the length of the run
+    bool on = B_pattern & (0x8000 >> bit);
+    uint8_t run = 1;
+    while (bit + run < B_pLength && (bool)(B_pattern & (0x8000 >> (bit + run))) == on) run++;
+    bit += run;
+    uint32_t ticks = run * B_interval * BLINKER_TICKS_PER_MS;
+    // Put it into as many halves as needed
+    while (ticks) {
+      uint32_t d = (ticks > MAXDURATION) ? MAXDURATION : ticks;
+      // A single half left for the last run? Split it to fill the last item
+      if (d == ticks && bit == B_pLength && !(halves & 1) && d > 1) d = ticks / 2;
+      if (halves >= 2 * MAXITEMS) return false;
+      rmt_item32_t &it = items[halves / 2];
+      if (halves & 1) {
+        it.duration1 = d;
+        it.level1 = on ? B_onState : !B_onState;
+      } else {
+        it.duration0 = d;
+        it.level0 = on ? B_onState : !B_onState;
+      }
+      halves++;
+      ticks -= d;
+    }
+  }
+  // Nothing to play?
+  if (!halves) return false;
+  // Odd number of halves? Close the last item with an end marker
+  if (halves & 1) {
+    items[halves / 2].duration1 = 0;
+    items[halves / 2].level1 = items[halves / 2].level0;
+    halves++;
+  }
+  if (rmt_set_gpio((rmt_channel_t)B_rmtChannel, RMT_MODE_TX, (gpio_num_t)B_port, false) != ESP_OK) return false;
+  return rmt_write_items((rmt_channel_t)B_rmtChannel, items, halves / 2, false) == ESP_OK;
+}
+#endif
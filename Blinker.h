@@ -18,9 +18,20 @@
 #define _BLINKER_H
 
 #include <Arduino.h>
+#if defined(ESP32)
+#include <driver/rmt.h>
+#endif
 
 #define BLINKER_DEFAULT 250
 #define BLINKER_PATTERN 0xF000
+// Time in ms update() reports as next due time if there is nothing to do
+#define BLINKER_IDLE 1000
+
+#if defined(ESP32)
+// RMT clock divider. The RMT is using the 1MHz REF_TICK, so one RMT tick is 250us
+#define BLINKER_RMTDIV 250
+#define BLINKER_TICKS_PER_MS (1000 / BLINKER_RMTDIV)
+#endif
 
 // Blinker: helper class to maintain blinking patterns for the LED
 class Blinker {
@@ -35,7 +46,19 @@ public:
   void stop();
 
   // update: check if the blinking pattern needs to be advanced a step
-  void update();
+  // Does nothing if the pattern is played by the RMT.
+  // Returns the time the next step is due, or BLINKER_IDLE ms ahead if stopped
+  uint32_t update();
+
+  // nextDue: time the next step is due, or BLINKER_IDLE ms ahead if there is nothing to do
+  uint32_t nextDue();
+
+#if defined(ESP32)
+  // useRMT: let the RMT channel play the patterns in hardware, without any update() calls.
+  // Returns false if the channel could not be set up. Patterns too long for the channel's
+  // memory will fall back to update().
+  bool useRMT(rmt_channel_t channel);
+#endif
 
 protected:
   uint8_t  B_counter;      // Number of bit currently processed
@@ -46,5 +69,10 @@ protected:
   uint32_t B_lastTick;     // Last interval start time
   uint32_t B_interval;     // Length of interval in milliseconds
   bool     B_onState;      // Pin state to switch the LED ON
+#if defined(ESP32)
+  int8_t   B_rmtChannel;   // RMT channel used, -1 if none
+  bool     B_rmtActive;    // Current pattern is played by the RMT
+  bool startRMT();         // Program the RMT with the current pattern
+#endif
 };
 #endif
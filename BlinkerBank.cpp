@@ -0,0 +1,153 @@
+// BlinkerBank
+// Copyright 2020 by miq1@gmx.de
+
+#include "BlinkerBank.h"
+#include "Instrument.h"
+#include "Tick.h"
+
+BlinkerBank::BlinkerBank() :
+  BB_count(0),
+  BB_epoch(Tick::now()),
+  BB_next(BB_epoch + BLINKER_IDLE) {
+}
+
+int BlinkerBank::add(uint8_t port, bool onState) {
+  if (BB_count >= BB_MAXLEDS || port >= BB_PINS) return -1;
+  for (uint8_t i = 0; i < BB_count; ++i) {
+    if (BB_led[i].port == port) return -1;
+  }
+  LED &l = BB_led[BB_count];
+  l.port = port;
+  l.onState = onState;
+  l.active = false;
+  BB_pattern[BB_count] = 0;
+  pinMode(port, OUTPUT);
+  digitalWrite(port, !onState);
+  return BB_count++;
+}
+
+// start: convert the pattern into runs and find the current run by the phase relative to the epoch
+uint32_t BlinkerBank::start(uint8_t led, uint16_t pattern, uint32_t interval) {
+  if (led >= BB_count) return BB_next;
+  LED &l = BB_led[led];
+  BB_pattern[led] = pattern;
+  // Shift the pattern left until the first '1' bit is found
+  uint8_t length = 16;
+  while (length && !(pattern & 0x8000)) {
+    pattern <<= 1;
+    length--;
+  }
+  if (!length || !interval) {
+    stop(led);
+    return BB_next;
+  }
+  // Collect the runs of equal bits
+  l.runs = 0;
+  l.levels = 0;
+  uint8_t bit = 0;
+  while (bit < length) {
+    bool on = pattern & (0x8000 >> bit);
+    uint8_t run = 1;
+    while (bit + run < length && (bool)(pattern & (0x8000 >> (bit + run))) == on) run++;
+    if (on) l.levels |= 1 << l.runs;
+    l.run[l.runs++] = run;
+    bit += run;
+  }
+  l.interval = interval;
+  l.period = length * interval;
+
+  // Where in the pattern are we now?
+  uint32_t now = Tick::now();
+  uint32_t pos = (now - BB_epoch) % l.period;
+  uint32_t end = l.run[0] * interval;
+  l.runIdx = 0;
+  while (end <= pos) {
+    l.runIdx++;
+    end += l.run[l.runIdx] * interval;
+  }
+  l.next = now - pos + end;
+  l.active = true;
+
+  BB_Mask bit1 = (BB_Mask)1 << l.port;
+  BB_Mask high = pinBit(l, l.runIdx);
+  writePins(high, bit1 & ~high);
+  if (before(l.next, BB_next)) BB_next = l.next;
+  return l.next;
+}
+
+void BlinkerBank::stop(uint8_t led) {
+  if (led >= BB_count) return;
+  LED &l = BB_led[led];
+  l.active = false;
+  digitalWrite(l.port, !l.onState);
+}
+
+// sync: all patterns are restarted from the new epoch
+void BlinkerBank::sync() {
+  BB_epoch = Tick::now();
+  BB_next = BB_epoch + BLINKER_IDLE;
+  for (uint8_t i = 0; i < BB_count; ++i) {
+    if (BB_led[i].active) start(i, BB_pattern[i], BB_led[i].interval);
+  }
+}
+
+uint32_t BlinkerBank::update() {
+  PROF_SCOPE("BlinkerBank::update");
+  uint32_t now = Tick::now();
+  // Anything to do?
+  if (before(now, BB_next)) return BB_next;
+
+  BB_Mask set = 0;
+  BB_Mask clear = 0;
+  uint32_t next = now + BLINKER_IDLE;
+  for (uint8_t i = 0; i < BB_count; ++i) {
+    LED &l = BB_led[i];
+    if (!l.active) continue;
+    // Transition due?
+    if (!before(now, l.next)) {
+      // Yes. Skip complete periods we may have missed
+      if (now - l.next >= l.period) l.next += (now - l.next) / l.period * l.period;
+      BB_Mask old = pinBit(l, l.runIdx);
+      // Advance to the run we are in now
+      do {
+        if (++l.runIdx == l.runs) l.runIdx = 0;
+        l.next += l.run[l.runIdx] * l.interval;
+      } while (!before(now, l.next));
+      BB_Mask high = pinBit(l, l.runIdx);
+      // Pin changed?
+      if (high != old) {
+        // Yes. Register it for set or clear
+        if (high) set |= high;
+        else      clear |= old;
+      }
+    }
+    if (before(l.next, next)) next = l.next;
+  }
+  writePins(set, clear);
+  BB_next = next;
+  return BB_next;
+}
+
+// writePins: one register write each for all pins to be set and cleared
+void BlinkerBank::writePins(BB_Mask set, BB_Mask clear) {
+#if defined(ESP32)
+  if ((uint32_t)set) REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)set);
+  if ((uint32_t)clear) REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clear);
+#ifdef GPIO_OUT1_W1TS_REG
+  if (set >> 32) REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(set >> 32));
+  if (clear >> 32) REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clear >> 32));
+#endif
+#elif defined(ESP8266)
+  if (set & 0xFFFF) GPOS = set & 0xFFFF;
+  if (clear & 0xFFFF) GPOC = clear & 0xFFFF;
+  // GPIO16 is not in the set/clear registers
+  if ((set | clear) & ((BB_Mask)1 << 16)) digitalWrite(16, (set >> 16) & 1);
+#else
+  // No register access known - write the GPIOs one by one
+  for (uint8_t i = 0; i < BB_count; ++i) {
+    BB_Mask bit = (BB_Mask)1 << BB_led[i].port;
+    if (set & bit) digitalWrite(BB_led[i].port, HIGH);
+    else if (clear & bit) digitalWrite(BB_led[i].port, LOW);
+  }
+#endif
+}
@@ -0,0 +1,93 @@
+// BlinkerBank
+// Copyright 2020 by miq1@gmx.de
+//
+// BlinkerBank drives a number of LEDs with Blinker patterns from one common time base.
+// The patterns are converted into tables of run lengths on start(), so update() only has to
+// compare the precomputed transition times with a single millis() reading. All pins changing
+// in an update() are written at once through the GPIO set/clear registers.
+// All transition times are derived from the bank's epoch, so LEDs with patterns of the same
+// length and interval are blinking in phase and will not drift apart.
+// 
+#ifndef _BLINKERBANK_H
+#define _BLINKERBANK_H
+#include <Arduino.h>
+#include "Blinker.h"
+#if defined(ESP32)
+#include <soc/gpio_reg.h>
+#endif
+
+// Maximum number of LEDs in a bank
+#ifndef BB_MAXLEDS
+#define BB_MAXLEDS 16
+#endif
+
+// One bit per GPIO
+#if defined(ESP32)
+typedef uint64_t BB_Mask;
+// Chips with a single GPIO bank, like the ESP32-C3, have no GPIO_OUT1 registers
+#ifdef GPIO_OUT1_W1TS_REG
+#define BB_PINS 34
+#else
+#define BB_PINS 32
+#endif
+#elif defined(ESP8266)
+typedef uint32_t BB_Mask;
+#define BB_PINS 17
+#else
+typedef uint64_t BB_Mask;
+#define BB_PINS 64
+#endif
+
+class BlinkerBank {
+public:
+  // Constructor: the epoch is set to the current time
+  BlinkerBank();
+
+  // add: put a LED into the bank. Returns the LED's index or -1 if the bank is full or the GPIO unusable
+  int add(uint8_t port, bool onState = HIGH);
+
+  // start: loop over the blinking pattern for LED led, in interval steps. Pattern and interval are
+  // like they are for Blinker. The pattern is joined in the phase it has relative to the epoch.
+  // Returns the time of the next transition.
+  uint32_t start(uint8_t led, uint16_t pattern = BLINKER_PATTERN, uint32_t interval = BLINKER_DEFAULT);
+
+  // stop: stop blinking LED led
+  void stop(uint8_t led);
+
+  // sync: set a new epoch and restart all patterns from their beginning
+  void sync();
+
+  // update: switch all LEDs that are due. Returns the time of the next transition
+  uint32_t update();
+
+  // nextDue: time of the next transition, or BLINKER_IDLE ms ahead if no LED is blinking
+  inline uint32_t nextDue() { return BB_next; }
+
+protected:
+  struct LED {
+    uint8_t port;                  // GPIO of the LED
+    bool onState;                  // Pin state to switch the LED ON
+    bool active;                   // LED is blinking
+    uint8_t runs;                  // Number of runs in the pattern
+    uint8_t runIdx;                // Current run
+    uint16_t levels;               // Bit i set: run i is ON
+    uint8_t run[16];               // Run lengths in intervals
+    uint32_t interval;             // Length of interval in milliseconds
+    uint32_t period;               // Length of the complete pattern in milliseconds
+    uint32_t next;                 // Time of the end of the current run
+  };
+  LED BB_led[BB_MAXLEDS];          // The LEDs
+  uint8_t BB_count;                // Number of LEDs in the bank
+  uint16_t BB_pattern[BB_MAXLEDS]; // Patterns as given to start(), for sync()
+  uint32_t BB_epoch;               // Common time base
+  uint32_t BB_next;                // Earliest transition of all LEDs
+
+  // before: wrap-safe comparison of times
+  inline static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+  // pinBit: mask bit for the pin state of LED l in run r
+  inline BB_Mask pinBit(const LED &l, uint8_t r) { return (((l.levels >> r) & 1) == l.onState) ? ((BB_Mask)1 << l.port) : 0; }
+  // writePins: set and clear the GPIOs in the masks
+  void writePins(BB_Mask set, BB_Mask clear);
+};
+
+#endif
@@ -0,0 +1,98 @@
+// ButtonGroup
+// Copyright 2020 by miq1@gmx.de
+
+#include "ButtonGroup.h"
+#include "Instrument.h"
+#include "Tick.h"
+
+ButtonGroup::ButtonGroup(uint32_t interval) :
+  BG_count(0),
+  BG_used(0),
+  BG_invert(0),
+  BG_state(0),
+  BG_cnt0(0),
+  BG_cnt1(0),
+  BG_cnt2(0),
+  BG_busy(0),
+  BG_interval(interval),
+  BG_timer(0),
+  BG_first(true) {
+  memset(BG_index, -1, sizeof(BG_index));
+}
+
+bool ButtonGroup::add(Buttoner &button) {
+  int port = button.getPort();
+  if (BG_count >= BG_MAXBUTTONS || port < 0 || port >= BG_PINS || BG_index[port] >= 0) return false;
+  BG_Mask bit = (BG_Mask)1 << port;
+  BG_button[BG_count] = &button;
+  BG_index[port] = BG_count;
+  BG_count++;
+  BG_used |= bit;
+  if (button.getOnState() == LOW) BG_invert |= bit;
+  // Start from the state found on the next scan
+  BG_first = true;
+  return true;
+}
+
+// readInputs: all GPIO levels in a single mask
+BG_Mask ButtonGroup::readInputs() {
+#if defined(ESP32)
+#ifdef GPIO_IN1_REG
+  return ((BG_Mask)(REG_READ(GPIO_IN1_REG) & 0xFF) << 32) | REG_READ(GPIO_IN_REG);
+#else
+  return REG_READ(GPIO_IN_REG);
+#endif
+#elif defined(ESP8266)
+  return (GPI & 0xFFFF) | ((BG_Mask)(GP16I & 1) << 16);
+#else
+  // No register access known - read the GPIOs one by one
+  BG_Mask in = 0;
+  for (uint8_t i = 0; i < BG_count; ++i) {
+    int port = BG_button[i]->getPort();
+    if (digitalRead(port)) in |= (BG_Mask)1 << port;
+  }
+  return in;
+#endif
+}
+
+int ButtonGroup::update() {
+  PROF_SCOPE("ButtonGroup::update");
+  uint32_t now = Tick::now();
+  // We do not sample in less than BG_interval intervals
+  if (now - BG_timer < BG_interval) {
+    return -1;
+  }
+  BG_timer = now;
+
+  BG_Mask sample = readInputs() & BG_used;
+  if (BG_first) {
+    BG_state = sample;
+    BG_cnt0 = BG_cnt1 = BG_cnt2 = 0;
+    BG_first = false;
+  }
+
+  // Vertical counter: each GPIO sampled differently from its debounced level counts up, 
+  // all others are reset. A GPIO toggles when its counter overflows after 8 samples.
+  BG_Mask delta = sample ^ BG_state;
+  BG_Mask toggle = delta & BG_cnt0 & BG_cnt1 & BG_cnt2;
+  BG_cnt2 = (BG_cnt2 ^ (BG_cnt1 & BG_cnt0)) & delta;
+  BG_cnt1 = (BG_cnt1 ^ BG_cnt0) & delta;
+  BG_cnt0 = ~BG_cnt0 & delta;
+  BG_state ^= toggle;
+
+  // Run the state machines of changed and waiting buttons only
+  BG_Mask run = toggle | BG_busy;
+  BG_Mask pressed = BG_state ^ BG_invert;
+  int events = 0;
+  for (uint8_t i = 0; i < BG_count; ++i) {
+    Buttoner *b = BG_button[i];
+    BG_Mask bit = (BG_Mask)1 << b->getPort();
+    if (run & bit) {
+      b->step(pressed & bit, now);
+      if (b->busy()) BG_busy |= bit;
+      else           BG_busy &= ~bit;
+    }
+    events += b->qSize();
+  }
+  return events;
+}
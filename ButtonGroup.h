@@ -0,0 +1,74 @@
+// ButtonGroup
+// Copyright 2020 by miq1@gmx.de
+//
+// ButtonGroup scans a number of Buttoners in one go. The GPIO input registers are read 
+// once per scan, all buttons are debounced in parallel by a vertical counter, and only
+// buttons whose state has changed or which are waiting for a timeout get their state machine run.
+// The Buttoners are used for their events only - their update() must not be called.
+// 
+#ifndef _BUTTONGROUP_H
+#define _BUTTONGROUP_H
+#include <Arduino.h>
+#include "Buttoner.h"
+#if defined(ESP32)
+#include <soc/gpio_reg.h>
+#endif
+
+// Maximum number of buttons in a group
+#ifndef BG_MAXBUTTONS
+#define BG_MAXBUTTONS 16
+#endif
+
+// Default scan interval in ms. 8 identical samples are needed to accept a new state.
+#define BG_INTERVAL 5
+
+// One bit per GPIO
+#if defined(ESP32)
+typedef uint64_t BG_Mask;
+// Chips with a single GPIO bank, like the ESP32-C3, have no GPIO_IN1_REG
+#ifdef GPIO_IN1_REG
+#define BG_PINS 40
+#else
+#define BG_PINS 32
+#endif
+#elif defined(ESP8266)
+typedef uint32_t BG_Mask;
+#define BG_PINS 17
+#else
+typedef uint64_t BG_Mask;
+#define BG_PINS 64
+#endif
+
+class ButtonGroup {
+public:
+  // Constructor: interval is the scan interval in ms
+  explicit ButtonGroup(uint32_t interval = BG_INTERVAL);
+
+  // add: put a Buttoner into the group. Returns false if the group is full or the GPIO unusable
+  bool add(Buttoner &button);
+
+  // update: scan all buttons and generate events. This function needs to be called frequently!
+  // Returns the number of events in all the buttons' queues, or -1 if the scan interval is not yet over.
+  int update();
+
+  // nextDue: time the next scan is due
+  inline uint32_t nextDue() { return BG_timer + BG_interval; }
+
+protected:
+  Buttoner *BG_button[BG_MAXBUTTONS];  // The buttons
+  int8_t BG_index[BG_PINS];            // Slot in BG_button for each GPIO, -1 if none
+  uint8_t BG_count;                    // Number of buttons in the group
+  BG_Mask BG_used;                     // GPIOs used by the group
+  BG_Mask BG_invert;                   // GPIOs that are LOW if the button is pressed
+  BG_Mask BG_state;                    // Debounced GPIO levels
+  BG_Mask BG_cnt0, BG_cnt1, BG_cnt2;   // Vertical counter: bit i of all three is the count for GPIO i
+  BG_Mask BG_busy;                     // Buttons waiting for a timeout
+  uint32_t BG_interval;                // Scan interval
+  uint32_t BG_timer;                   // Time of the last scan
+  bool BG_first;                       // No scan done yet
+
+  // readInputs: get all GPIO levels at once
+  BG_Mask readInputs();
+};
+
+#endif
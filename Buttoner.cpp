@@ -2,16 +2,29 @@
 // Copyright 2020 by miq1@gmx.de
 
 #include "Buttoner.h"
+#include "Instrument.h"
+#include "Tick.h"
+#include <new>
 
 Buttoner::Buttoner(int port, bool onState, bool pullUp, uint32_t queueSize) :
   BE_port(port),
   BE_onState(onState),
-  BE_queueSize(queueSize),
   BE_doubleClickTime(BE_defaultDCT),
   BE_pressTime(BE_defaultPT),
   BE_state(BS_IDLE),
+  BE_timer(0),
   BE_keyState(0),
-  BE_stateTimer(0) {
+  BE_stateTimer(0),
+  BE_eventList(queueSize ? queueSize : BE_UNBOUNDED),
+  BE_useIRQ(false),
+  BE_debounceTime(BE_defaultDBT),
+  BE_edges(nullptr),
+  BE_edgeHead(0),
+  BE_edgeTail(0),
+  BE_edgeLost(false),
+  BE_rawState(false),
+  BE_rawTime(0),
+  BE_stableState(false) {
   // If pullUp is set, configure the GPIO accordingly
   if (pullUp) {
     pinMode(BE_port, INPUT_PULLUP);
@@ -21,19 +34,31 @@ Buttoner::Buttoner(int port, bool onState, bool pullUp, uint32_t queueSize) :
 }
 
 ButtonEvent Buttoner::getEvent() {
-  if (BE_eventList.empty()) return BE_NONE;
-  ButtonEvent be = BE_eventList.front();
-  BE_eventList.pop();
-  return be;
+  uint32_t time;
+  return getEvent(time);
+}
+
+ButtonEvent Buttoner::getEvent(uint32_t &time) {
+  EventEntry e;
+  if (!BE_eventList.safeCopy(&e, 1, true)) return BE_NONE;
+  time = e.time;
+  return e.event;
 }
 
 ButtonEvent Buttoner::peekEvent() {
-  if (BE_eventList.empty()) return BE_NONE;
-  return BE_eventList.front();
+  uint32_t time;
+  return peekEvent(time);
+}
+
+ButtonEvent Buttoner::peekEvent(uint32_t &time) {
+  EventEntry e;
+  if (!BE_eventList.safeCopy(&e, 1)) return BE_NONE;
+  time = e.time;
+  return e.event;
 }
 
 void Buttoner::clearEvents() {
-  queue<ButtonEvent>().swap(BE_eventList);
+  BE_eventList.clear();
 }
 
 void Buttoner::setTiming(uint32_t doubleClickTime, uint32_t pressTime) {
@@ -41,27 +66,145 @@ void Buttoner::setTiming(uint32_t doubleClickTime, uint32_t pressTime) {
   BE_pressTime = pressTime;
 }
 
+Buttoner::~Buttoner() {
+  if (BE_useIRQ) detachInterrupt(digitalPinToInterrupt(BE_port));
+  delete BE_edges;
+}
+
+// useInterrupt: start or stop recording edges
+bool Buttoner::useInterrupt(bool on, uint32_t debounceTime) {
+  BE_debounceTime = debounceTime;
+  if (on == BE_useIRQ) return BE_useIRQ;
+  if (on) {
+    // Get the edge buffer, if we have none yet. It is kept for the next switch to interrupt mode.
+    if (!BE_edges) BE_edges = new (std::nothrow) EdgeRing;
+    // No memory? Then we stay in polling mode
+    if (!BE_edges) return false;
+    // Start from the current button state
+    BE_edgeHead = 0;
+    BE_edgeTail = 0;
+    BE_edgeLost = false;
+    BE_rawState = BE_stableState = (digitalRead(BE_port) == BE_onState);
+    BE_rawTime = Tick::now();
+    BE_useIRQ = true;
+    attachInterruptArg(digitalPinToInterrupt(BE_port), isr, this, CHANGE);
+  } else {
+    detachInterrupt(digitalPinToInterrupt(BE_port));
+    BE_useIRQ = false;
+    BE_keyState = 0;
+  }
+  return BE_useIRQ;
+}
+
+// isr: record the time and the new level of an edge
+void IRAM_ATTR Buttoner::isr(void *arg) {
+  Buttoner *b = static_cast<Buttoner *>(arg);
+  uint8_t t = b->BE_edgeTail.load(std::memory_order_relaxed);
+  uint8_t next = (t + 1) % BE_EDGES;
+  // Buffer full?
+  if (next == b->BE_edgeHead.load(std::memory_order_acquire)) {
+    // Yes. update() will have to resynchronize
+    b->BE_edgeLost = true;
+    return;
+  }
+  b->BE_edges->time[t] = millis();
+  b->BE_edges->level[t] = (digitalRead(b->BE_port) == b->BE_onState);
+  b->BE_edgeTail.store(next, std::memory_order_release);
+}
+
+void Buttoner::addEvent(ButtonEvent e) {
+  BE_eventList.push_back(EventEntry { e, BE_timer });
+}
+
 int Buttoner::update() {
-  // We do not sample in less than 5ms intervals
-  if (millis() - BE_stateTimer < 5) {
+  PROF_SCOPE("Buttoner::update");
+  // Interrupt mode?
+  if (BE_useIRQ) {
+    // Yes. Evaluate all recorded edges. A level is accepted once it was held for BE_debounceTime,
+    // dated to the time of its edge, so the timing is right no matter how late we get here.
+    uint32_t now = Tick::now();
+    uint8_t h = BE_edgeHead.load(std::memory_order_relaxed);
+    while (h != BE_edgeTail.load(std::memory_order_acquire)) {
+      uint32_t t = BE_edges->time[h];
+      // The edge may have come after the loop pass had started
+      if ((int32_t)(t - now) > 0) now = t;
+      bool level = BE_edges->level[h];
+      h = (h + 1) % BE_EDGES;
+      BE_edgeHead.store(h, std::memory_order_release);
+      // Did the previous level last long enough?
+      if (BE_rawState != BE_stableState && t - BE_rawTime >= BE_debounceTime) {
+        // Yes. Let timeouts of the old level up to the edge run first, then take it
+        step(BE_stableState, BE_rawTime);
+        BE_stableState = BE_rawState;
+        step(BE_stableState, BE_rawTime);
+      }
+      BE_rawState = level;
+      BE_rawTime = t;
+    }
+    // Were edges lost?
+    if (BE_edgeLost) {
+      // Yes. Continue with the current level
+      BE_edgeLost = false;
+      bool level = (digitalRead(BE_port) == BE_onState);
+      if (level != BE_rawState) {
+        BE_rawState = level;
+        BE_rawTime = now;
+      }
+    }
+    // Latest level stable by now?
+    if (BE_rawState != BE_stableState && now - BE_rawTime >= BE_debounceTime) {
+      step(BE_stableState, BE_rawTime);
+      BE_stableState = BE_rawState;
+      step(BE_stableState, BE_rawTime);
+    }
+    // Let the timeouts run. If a level is still to be debounced, the stable one only lasted until its edge.
+    step(BE_stableState, (BE_rawState != BE_stableState) ? BE_rawTime : now);
+    return BE_eventList.size();
+  }
+
+  // We do not sample in less than BE_sampleTime intervals
+  uint32_t now = Tick::now();
+  if (now - BE_stateTimer < BE_sampleTime) {
     return -1;
   }
-  BE_stateTimer = millis();
+  BE_stateTimer = now;
 
   // Get debounced button state
   // The 0xFC00 (first six bits set) results in 16-6=10 samples being considered 
   // to determine the button state (= 50ms)
   const uint16_t SAMPLES(0xFC00);
   BE_keyState = (BE_keyState << 1) | (digitalRead(BE_port) != BE_onState) | SAMPLES;
-  bool buttonState = (BE_keyState == SAMPLES);
+  step(BE_keyState == SAMPLES, BE_stateTimer);
+  return BE_eventList.size();
+}
 
-  // State machine...
+// nextDue: find the time update() has something to do
+uint32_t Buttoner::nextDue() {
+  // Polling mode?
+  if (!BE_useIRQ) {
+    // Yes. Next sample is due
+    return BE_stateTimer + BE_sampleTime;
+  }
+  // Edges waiting to be evaluated?
+  if (BE_edgeHead.load(std::memory_order_relaxed) != BE_edgeTail.load(std::memory_order_acquire) || BE_edgeLost) {
+    return Tick::now();
+  }
+  // Level to be debounced?
+  if (BE_rawState != BE_stableState) return BE_rawTime + BE_debounceTime;
+  // Timeouts running?
+  if (BE_state == BS_CLICKED1) return BE_timer + BE_pressTime + 1;
+  if (BE_state == BS_RELEASED1) return BE_timer + BE_doubleClickTime + 1;
+  return Tick::now() + BE_idleTime;
+}
+
+// step: the state machine proper
+void Buttoner::step(bool buttonState, uint32_t now) {
   switch (BE_state) {
   case BS_IDLE:  // Waiting for something to happen
     // Button pressed?
     if (buttonState) {
       // Yes. Wind up timer and proceed to next state
-      BE_timer = millis();
+      BE_timer = now;
       BE_state = BS_CLICKED1;
     }
     break;
@@ -69,9 +212,9 @@ int Buttoner::update() {
     // Button still held down?
     if (buttonState) {
       // Yes. Did the holding time pass?
-      if (millis() - BE_timer > BE_pressTime) {
+      if (now - BE_timer > BE_pressTime) {
         // Yes. Report a PRESS event
-        if (!BE_queueSize || BE_eventList.size() < BE_queueSize)  BE_eventList.push(BE_PRESS);
+        addEvent(BE_PRESS);
         // Go into cooldown phase to have the button released again
         BE_state = BS_COOLDOWN;
       }
@@ -82,16 +225,16 @@ int Buttoner::update() {
     break;
   case BS_RELEASED1: // Button was released after the first click
     // Did the time for double clicks pass without another click?
-    if (millis() - BE_timer > BE_doubleClickTime) {
+    if (now - BE_timer > BE_doubleClickTime) {
       // Yes. report a single click then. No cooldown required!
-      if (!BE_queueSize || BE_eventList.size() < BE_queueSize)  BE_eventList.push(BE_CLICK);
+      addEvent(BE_CLICK);
       BE_state = BS_IDLE;
     } else {
       // No, still waiting for second click.
       // Was the button clicked again?
       if (buttonState) {
         // Yes. Report double click and proceed to cooldown
-        if (!BE_queueSize || BE_eventList.size() < BE_queueSize)  BE_eventList.push(BE_DOUBLECLICK);
+        addEvent(BE_DOUBLECLICK);
         BE_state = BS_COOLDOWN;
       }
     }
@@ -104,5 +247,4 @@ int Buttoner::update() {
   default: // May not get here, but lint likes it...
     break;
   }
-  return BE_eventList.size();
 }
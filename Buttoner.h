@@ -8,16 +8,30 @@
 #ifndef _BUTTONER_H
 #define _BUTTONER_H
 #include <Arduino.h>
-#include <queue>
-
-using std::queue;
+#include <atomic>
+#include "RingBuf.h"
 
 // Reported events
 enum ButtonEvent : uint8_t { BE_NONE = 0, BE_CLICK, BE_DOUBLECLICK, BE_PRESS };
 
+// Number of events held for a queueSize of 0. The queue was unbounded then before, 
+// but the event ring needs a size.
+#ifndef BE_UNBOUNDED
+#define BE_UNBOUNDED 32
+#endif
+
 // Timing values
 const uint32_t BE_defaultDCT(250);   // maximum time between clicks of a double click
 const uint32_t BE_defaultPT(400);    // holding time to determine a held button
+const uint32_t BE_defaultDBT(50);    // time a level must be stable after an edge in interrupt mode
+const uint32_t BE_sampleTime(5);     // polling interval to sample the GPIO
+const uint32_t BE_idleTime(1000);    // time nextDue() reports ahead if there is nothing to do
+
+// Number of edges the interrupt routine can hold until update() is called. 
+// Please note that a bouncing contact may produce several edges per click!
+#ifndef BE_EDGES
+#define BE_EDGES 32
+#endif
 
 class Buttoner {
 public:
@@ -25,19 +39,43 @@ public:
   // - port: GPIO number (mandatory)
   // - onState: logic level of the GPIO when the button is pressed
   // - pullUp: set to true to have the GPIO configured as INPUT_PULLUP
-  // - queueSize: number of events to keep (0=unlimited)
+  // - queueSize: number of events to keep (0: BE_UNBOUNDED). The ring is allocated here once.
   explicit Buttoner(int port, bool onState = HIGH, bool pullUp = false, uint32_t queueSize = 4);
 
+  // Destructor: detach the interrupt, if one was used, and free the edge buffer
+  ~Buttoner();
+
+  // useInterrupt: switch to interrupt mode (or back to polling with on = false).
+  // An interrupt routine is recording the times of the GPIO's edges, update() will evaluate them 
+  // later. update() then needs not be called that frequently, and idle cost is next to nothing.
+  // debounceTime is the time the GPIO level has to be stable after an edge.
+  // The edge buffer is allocated with the first call, so polling Buttoners do not carry it.
+  // Returns true if interrupt mode is active - false if it was switched off or memory was short.
+  bool useInterrupt(bool on = true, uint32_t debounceTime = BE_defaultDBT);
+
   // update: polling function to read the button state and generate events. This function
-  // needs to be called frequently!
+  // needs to be called frequently! In interrupt mode it only needs to be called before the events
+  // are looked at.
   // Returns the number of events currently held in queue
   int update();
 
+  // nextDue: time the next update() call is needed. In polling mode this is the next sample, 
+  // in interrupt mode the end of a debounce time or an event timeout - or BE_idleTime ahead,
+  // as the interrupt routine is recording edges meanwhile.
+  uint32_t nextDue();
+
+  // step: run the state machine with a debounced button state, pressed or not, at time now.
+  // Used by update(), but may be called directly for buttons read by other means.
+  void step(bool pressed, uint32_t now);
+
   // getEvent: pull first event from queue, deleting it from the queue
+  // time will receive the time in ms the button was first pressed for the event
   ButtonEvent getEvent();
+  ButtonEvent getEvent(uint32_t &time);
 
   // peekEvent: get first event from queue, but leaving the entry in queue
   ButtonEvent peekEvent();
+  ButtonEvent peekEvent(uint32_t &time);
 
   // clearEvents: purge all events unseen from queue
   void clearEvents();
@@ -48,11 +86,17 @@ public:
   // qSize: get the number of events curently in queue
   inline uint32_t qSize() { return BE_eventList.size(); }
 
+  // getPort, getOnState: the GPIO and its level for a pressed button
+  inline int getPort() { return BE_port; }
+  inline bool getOnState() { return BE_onState; }
+
+  // busy: true if the state machine is waiting for a timeout, so step() needs to be called
+  // even if the button state does not change
+  inline bool busy() { return BE_state == BS_CLICKED1 || BE_state == BS_RELEASED1; }
+
 protected:
   int BE_port;                     // GPIO number of button
   bool BE_onState;                 // logical level of a button pressed down
-  uint32_t BE_queueSize;           // Queue size limit
-
   uint32_t BE_doubleClickTime;     // Time between double clicks for this button
   uint32_t BE_pressTime;           // Time to detect a held button for this button
 
@@ -63,7 +107,31 @@ protected:
   uint32_t BE_timer;               // Timer watching the clicking times
   uint16_t BE_keyState;            // Shift register to hold sampled button states
   uint32_t BE_stateTimer;          // Timer to maintain polling interval
-  queue<ButtonEvent> BE_eventList; // Queue of events
+  // Queue of events. No locking needed, as events are produced and consumed in the same task.
+  // A full queue keeps the older events.
+  struct EventEntry {
+    ButtonEvent event;
+    uint32_t time;                 // Time of the first press of the event
+  };
+  RingBuf<EventEntry, RB_NOLOCK, 0, RB_PRESERVE> BE_eventList;
+
+  // Interrupt mode. The interrupt routine is the only writer of BE_edgeTail and the edge data,
+  // update() the only writer of BE_edgeHead.
+  struct EdgeRing {
+    uint32_t time[BE_EDGES];       // Times of the recorded edges
+    bool level[BE_EDGES];          // Button pressed after the edge?
+  };
+  bool BE_useIRQ;                  // Interrupt mode active
+  uint32_t BE_debounceTime;        // Time an edge's level has to be stable
+  EdgeRing *BE_edges;              // Edge buffer, allocated by the first useInterrupt()
+  std::atomic<uint8_t> BE_edgeHead;  // Next edge to be evaluated
+  std::atomic<uint8_t> BE_edgeTail;  // Next slot to be written by the interrupt routine
+  std::atomic<bool> BE_edgeLost;     // The interrupt routine found the edge buffer full
+  bool BE_rawState;                // Button state after the latest edge
+  uint32_t BE_rawTime;             // Time of the latest edge
+  bool BE_stableState;             // Debounced button state
+  static void isr(void *arg);      // Interrupt routine
+  void addEvent(ButtonEvent e);    // Put an event into the queue, if there is room. Time is BE_timer
 };
 
 #endif
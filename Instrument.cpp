@@ -0,0 +1,63 @@
+// Instrument
+// Copyright 2020 by miq1@gmx.de
+
+#include "Instrument.h"
+
+#ifdef PROF_ENABLE
+// Head of the list of sites. Sites are only added, so pushing them to the front is all we need.
+static std::atomic<ProfSite *> profFirst(nullptr);
+
+ProfSite::ProfSite(const char *n, int l) :
+  name(n),
+  line(l),
+  next(nullptr) {
+  reset();
+  ProfSite *head = profFirst.load();
+  do {
+    next = head;
+  } while (!profFirst.compare_exchange_weak(head, this));
+}
+
+void ProfSite::reset() {
+  count = 0;
+  min = UINT32_MAX;
+  max = 0;
+  sum = 0;
+  memset(hist, 0, sizeof(hist));
+}
+
+uint32_t ProfSite::percentile(uint8_t p) {
+  // Number of measurements at or below the percentile
+  uint64_t n = ((uint64_t)count * p + 99) / 100;
+  uint64_t seen = 0;
+  for (uint8_t b = 0; b < PROF_BUCKETS - 1; ++b) {
+    seen += hist[b];
+    if (seen >= n) {
+      uint32_t upper = (2UL << b) - 1;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+void profDump(Print &output) {
+  double perUs = profCyclesPerUs();
+  output.printf("%-28s %8s %9s %9s %9s %9s %9s %9s [us]\n", "Scope", "count", "min", "avg", "max", "p50", "p90", "p99");
+  for (ProfSite *s = profFirst.load(); s; s = s->next) {
+    char name[32];
+    if (s->line) snprintf(name, sizeof(name), "%s:%d", s->name, s->line);
+    else         snprintf(name, sizeof(name), "%s", s->name);
+    if (!s->count) {
+      output.printf("%-28s %8u\n", name, 0U);
+      continue;
+    }
+    output.printf("%-28s %8u %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, (unsigned int)s->count,
+      s->min / perUs, (double)s->sum / s->count / perUs, s->max / perUs,
+      s->percentile(50) / perUs, s->percentile(90) / perUs, s->percentile(99) / perUs);
+  }
+}
+
+void profReset() {
+  for (ProfSite *s = profFirst.load(); s; s = s->next) s->reset();
+}
+#endif
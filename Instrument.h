@@ -0,0 +1,90 @@
+// Instrument
+// Copyright 2020 by miq1@gmx.de
+//
+// Lightweight instrumentation of hot paths. PROF_SCOPE(name) measures the CPU cycles from its place
+// in a block to the end of that block. Each scope collects count, min, max, sum and a histogram of 
+// power-of-two buckets in a static ProfSite - no heap is used. PROF_DUMP(output) prints them all,
+// with min/avg/max and percentiles in microseconds, to any Print - e.g. a TelnetLog.
+// All this is only compiled with PROF_ENABLE defined for the whole project. Else the macros 
+// expand to nothing.
+// 
+#ifndef _INSTRUMENT_H
+#define _INSTRUMENT_H
+#include <Arduino.h>
+
+#ifdef PROF_ENABLE
+#include <atomic>
+
+// Number of histogram buckets. Bucket i counts durations of 2^i..2^(i+1)-1 cycles, the last one all above.
+#ifndef PROF_BUCKETS
+#define PROF_BUCKETS 24
+#endif
+
+// profCycles: read the cycle counter. Targets without one are measured in microseconds.
+#if defined(ESP32) || defined(ESP8266)
+inline uint32_t profCycles() { return ESP.getCycleCount(); }
+inline uint32_t profCyclesPerUs() { return ESP.getCpuFreqMHz(); }
+#else
+inline uint32_t profCycles() { return micros(); }
+inline uint32_t profCyclesPerUs() { return 1; }
+#endif
+
+// ProfSite: statistics of a scope. All sites are linked into a list on their first use.
+// Concurrent tasks in the same scope may make the statistics inaccurate.
+struct ProfSite {
+  const char *name;            // Scope name
+  int line;                    // Line number to tell apart scopes of the same name, 0 if not needed
+  uint32_t count;              // Number of measurements
+  uint32_t min;                // Shortest duration
+  uint32_t max;                // Longest duration
+  uint64_t sum;                // Sum of all durations
+  uint32_t hist[PROF_BUCKETS]; // Histogram
+  ProfSite *next;              // Next site in list
+
+  explicit ProfSite(const char *n, int l = 0);
+
+  // add: record a duration
+  inline void add(uint32_t cycles) {
+    count++;
+    sum += cycles;
+    if (cycles < min) min = cycles;
+    if (cycles > max) max = cycles;
+    uint8_t b = cycles ? 31 - __builtin_clz(cycles) : 0;
+    hist[b < PROF_BUCKETS ? b : PROF_BUCKETS - 1]++;
+  }
+
+  // reset: forget all measurements
+  void reset();
+
+  // percentile: upper bound in cycles of the bucket holding the p-th percentile, at most max
+  uint32_t percentile(uint8_t p);
+};
+
+// ProfTimer: measure the time from construction to destruction into a ProfSite
+class ProfTimer {
+public:
+  explicit ProfTimer(ProfSite &site) : PT_site(site), PT_start(profCycles()) {}
+  ~ProfTimer() { PT_site.add(profCycles() - PT_start); }
+protected:
+  ProfSite &PT_site;
+  uint32_t PT_start;
+};
+
+// profDump: print the statistics of all sites used so far
+void profDump(Print &output);
+
+// profReset: forget the measurements of all sites
+void profReset();
+
+#define PROF_CONCAT2(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT2(a, b)
+#define PROF_SCOPE(name) static ProfSite PROF_CONCAT(profSite, __LINE__)(name); ProfTimer PROF_CONCAT(profTimer, __LINE__)(PROF_CONCAT(profSite, __LINE__))
+#define PROF_DUMP(output) profDump(output)
+#define PROF_RESET() profReset()
+#else
+#define PROF_SCOPE(name)
+#define PROF_DUMP(output)
+#define PROF_RESET()
+#endif  // PROF_ENABLE
+
+#endif
@@ -0,0 +1,83 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "LogHistory.h"
+#include <new>
+
+#define LH_MAGIC 0x4C4F4748   // "LOGH"
+
+// The memory for the history buffer. The constructor of the RingBuf must not run at startup,
+// so it is raw memory, initialized by LogHistory when needed.
+struct HistoryStore {
+  uint32_t magic;
+  uint32_t size;
+  alignas(StaticRingBuf<uint8_t, LH_SIZE, RB_OVERWRITE, RB_NOLOCK>) 
+    uint8_t buffer[sizeof(StaticRingBuf<uint8_t, LH_SIZE, RB_OVERWRITE, RB_NOLOCK>)];
+};
+static LH_NOINIT HistoryStore historyStore;
+
+// Constructor: check if the store holds a history, set up a new one if not
+LogHistory::LogHistory() {
+  LH_buffer = reinterpret_cast<Buffer *>(historyStore.buffer);
+  LH_restored = (historyStore.magic == LH_MAGIC && historyStore.size == LH_SIZE && LH_buffer->consistent());
+  if (LH_restored) {
+    // Mark the reset in the history
+    const char *mark = "\n--- restart ---\n";
+    LH_buffer->push_back((const uint8_t *)mark, strlen(mark));
+  } else {
+    new (historyStore.buffer) Buffer();
+    historyStore.size = LH_SIZE;
+    historyStore.magic = LH_MAGIC;
+  }
+}
+
+size_t LogHistory::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+// write: add output, overwriting the oldest
+size_t LogHistory::write(const uint8_t *buffer, size_t size) {
+  LOCK_GUARD(cLock, LH_lock);
+  LH_buffer->push_back(buffer, size);
+  return size;
+}
+
+size_t LogHistory::size() {
+  LOCK_GUARD(cLock, LH_lock);
+  return LH_buffer->size();
+}
+
+void LogHistory::clear() {
+  LOCK_GUARD(cLock, LH_lock);
+  LH_buffer->clear();
+}
+
+// replay: write out the tail of the history
+size_t LogHistory::replay(Print &out, size_t tail) {
+  LOCK_GUARD(cLock, LH_lock);
+  Buffer::Span span[2];
+  size_t n = LH_buffer->spans(span[0], span[1]);
+  size_t skip = 0;
+  if (n > tail) {
+    skip = n - tail;
+    // Start behind the next line end, if there is one - which may be just before skip
+    for (size_t i = skip - 1; i < n; ++i) {
+      size_t s = (i < span[0].size) ? 0 : 1;
+      if (span[s].data[i - s * span[0].size] == '\n') {
+        skip = i + 1;
+        break;
+      }
+    }
+  }
+  size_t written = 0;
+  for (uint8_t s = 0; s < 2; ++s) {
+    if (skip >= span[s].size) {
+      skip -= span[s].size;
+      continue;
+    }
+    written += out.write(span[s].data + skip, span[s].size - skip);
+    skip = 0;
+  }
+  return written;
+}
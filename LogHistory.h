@@ -0,0 +1,58 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+
+#ifndef _LOGHISTORY_H
+#define _LOGHISTORY_H
+// Include Arduino.h to make Print and Serial known
+#include <Arduino.h>
+#include "RingBuf.h"
+
+// Size of the history in bytes. There is only one history buffer.
+#ifndef LH_SIZE
+#define LH_SIZE 4096
+#endif
+
+// Default number of bytes replayed
+#define LH_TAIL 1024
+
+// On the ESP32 the history is kept in RAM that is not initialized at startup, so it will
+// survive watchdog and software resets. Elsewhere it is kept in normal RAM.
+#if defined(ESP32)
+#define LH_NOINIT __NOINIT_ATTR
+#else
+#define LH_NOINIT
+#endif
+
+// LogHistory: a Print keeping the last LH_SIZE bytes of output. Add it as a log sink to record 
+// all log output, and replay() it to see what happened before - or before the last reset.
+class LogHistory : public Print {
+public:
+  // Constructor: take over the history from before a reset, if there is a consistent one
+  LogHistory();
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+
+  // restored: true if the history survived a reset
+  inline bool restored() { return LH_restored; }
+
+  // replay: write the last tail bytes of the history to out, starting at a line boundary.
+  // Returns the number of bytes written.
+  size_t replay(Print &out, size_t tail = LH_TAIL);
+
+  // size: number of bytes in the history
+  size_t size();
+
+  // clear: forget the history
+  void clear();
+
+protected:
+  typedef StaticRingBuf<uint8_t, LH_SIZE, RB_OVERWRITE, RB_NOLOCK> Buffer;
+  Buffer *LH_buffer;     // Buffer in the noinit area
+  RB_Lock LH_lock;       // The buffer itself is not locking, as it must not hold a mutex across resets
+  bool LH_restored;
+};
+
+#endif
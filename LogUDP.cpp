@@ -0,0 +1,95 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "LogUDP.h"
+#include "Tick.h"
+
+LogUDP::LogUDP(size_t bufSize) :
+  LU_buffer(bufSize, true),
+  LU_targets(0),
+  LU_latency(LU_LATENCY),
+  LU_first(0),
+  LU_dropped(0),
+  LU_datagrams(0) {
+}
+
+bool LogUDP::addTarget(IPAddress ip, uint16_t port) {
+  for (uint8_t i = 0; i < LU_targets; ++i) {
+    if (LU_target[i].ip == ip && LU_target[i].port == port) return true;
+  }
+  if (LU_targets >= LU_MAXTARGETS) return false;
+  LU_target[LU_targets].ip = ip;
+  LU_target[LU_targets].port = port;
+  LU_targets++;
+  return true;
+}
+
+bool LogUDP::removeTarget(IPAddress ip, uint16_t port) {
+  for (uint8_t i = 0; i < LU_targets; ++i) {
+    if (LU_target[i].ip == ip && LU_target[i].port == port) {
+      // Move the last one into the gap
+      LU_target[i] = LU_target[--LU_targets];
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t LogUDP::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+// write: collect output. The buffer is preserving, so output not fitting is dropped
+size_t LogUDP::write(const uint8_t *buffer, size_t size) {
+  // First output to wait? Start the latency timer
+  if (LU_buffer.empty()) LU_first = millis();
+  if (!LU_buffer.push_back(buffer, size)) LU_dropped += size;
+  return size;
+}
+
+void LogUDP::update() {
+  // Send all full datagrams
+  while (sendDatagram(false)) {}
+  // Has the remainder waited long enough?
+  if (!LU_buffer.empty() && millis() - LU_first >= LU_latency) {
+    // Yes. Send it as well
+    flush();
+  }
+}
+
+void LogUDP::flush() {
+  while (sendDatagram(true)) {}
+}
+
+// nextDue: based on Tick like the Scheduler. LU_first stays on millis(), as write() may be called by any task
+uint32_t LogUDP::nextDue() {
+  if (LU_buffer.size() >= LU_DATAGRAM) return Tick::now();
+  if (LU_buffer.empty()) return Tick::now() + LU_latency;
+  return LU_first + LU_latency;
+}
+
+// sendDatagram: copy a datagram's worth of output, cut it behind the last complete line and send it
+// to all collectors. The buffer is only popped here, so the copy is still valid when we pop it.
+bool LogUDP::sendDatagram(bool all) {
+  size_t len = LU_buffer.safeCopy(LU_datagram, LU_DATAGRAM);
+  if (!len) return false;
+  // Datagram not full? Then we will send it only if we must
+  if (len < LU_DATAGRAM && !all) return false;
+  // Full datagram? Then cut it behind the last line end, if there is one
+  if (len == LU_DATAGRAM) {
+    size_t cut = len;
+    while (cut && LU_datagram[cut - 1] != '\n') cut--;
+    if (cut) len = cut;
+  }
+  for (uint8_t i = 0; i < LU_targets; ++i) {
+    if (LU_udp.beginPacket(LU_target[i].ip, LU_target[i].port)) {
+      LU_udp.write(LU_datagram, len);
+      LU_udp.endPacket();
+    }
+  }
+  LU_buffer.pop(len);
+  LU_datagrams++;
+  // Output left over keeps LU_first - it was written after that, so it will not wait longer than the latency
+  return true;
+}
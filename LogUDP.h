@@ -0,0 +1,89 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+
+#ifndef _LOGUDP_H
+#define _LOGUDP_H
+// Include Arduino.h to make Print and Serial known
+#include <Arduino.h>
+#include <atomic>
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+#include <WiFiUdp.h>
+#include "RingBuf.h"
+
+// Largest datagram payload: 1500 bytes Ethernet MTU minus IP and UDP headers
+#ifndef LU_DATAGRAM
+#define LU_DATAGRAM 1472
+#endif
+
+// Default size of the output buffer
+#define LU_BUFSIZE 4096
+
+// Maximum number of collectors
+#ifndef LU_MAXTARGETS
+#define LU_MAXTARGETS 4
+#endif
+
+// Default collector port and time in ms output may wait for a datagram to be filled.
+// The datagrams hold plain lines without a syslog <PRI> header, so the syslog port 514 is not used.
+#ifndef LU_PORT
+#define LU_PORT 4514
+#endif
+#define LU_LATENCY 200
+
+// LogUDP: a Print sending its output to one or more collectors as UDP datagrams.
+// Output is collected in a RingBuf and sent in datagrams of complete lines, as many as fit into 
+// LU_DATAGRAM bytes. A datagram is sent when it is full, or when the oldest output in it has 
+// waited for the flush latency. Each datagram is sent once to every collector - there is no
+// per-collector state and no acknowledgement. Output not fitting into the buffer is dropped.
+// Add it as a log sink to send all log output, e.g. addLogSink(&udpLog, LOG_LEVEL_INFO).
+class LogUDP : public Print {
+public:
+  explicit LogUDP(size_t bufSize = LU_BUFSIZE);
+
+  // addTarget: send to a collector as well. Returns false if all LU_MAXTARGETS are taken
+  bool addTarget(IPAddress ip, uint16_t port = LU_PORT);
+  // removeTarget: stop sending to a collector. Returns false if it was not found
+  bool removeTarget(IPAddress ip, uint16_t port = LU_PORT);
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+
+  // setLatency: longest time in ms output may wait until it is sent. 0 will send all output with update()
+  inline void setLatency(uint32_t maxLatency) { LU_latency = maxLatency; }
+
+  // update: send all full datagrams, and the rest if it has waited long enough. Call it in your loop()
+  void update();
+  // flush: send all output now
+  void flush();
+  // nextDue: time update() has to be called next
+  uint32_t nextDue();
+
+  // getDropped: number of bytes that did not fit into the buffer
+  inline uint32_t getDropped() { return LU_dropped; }
+  // getDatagrams: number of datagrams sent (to each collector)
+  inline uint32_t getDatagrams() { return LU_datagrams; }
+
+protected:
+  struct Target {
+    IPAddress ip;
+    uint16_t port;
+  };
+  RingBuf<uint8_t> LU_buffer;            // Output not yet sent
+  WiFiUDP LU_udp;                        // Socket to send from
+  Target LU_target[LU_MAXTARGETS];       // Collectors
+  uint8_t LU_targets;                    // Number of collectors
+  uint8_t LU_datagram[LU_DATAGRAM];      // Datagram being sent
+  uint32_t LU_latency;                   // Max. time in ms output may wait
+  std::atomic<uint32_t> LU_first;        // Time the oldest output waiting has been written, or earlier
+  std::atomic<uint32_t> LU_dropped;      // Number of bytes dropped
+  uint32_t LU_datagrams;                 // Number of datagrams sent
+  // sendDatagram: send the next datagram. Incomplete ones only if all is true. Returns false if none was sent
+  bool sendDatagram(bool all);
+};
+#endif
@@ -6,54 +6,484 @@
 
 int MBUlogLvl = LOG_LEVEL;
 Print *LOGDEVICE = &Serial;
+int MBUsinkLvl = LOG_LEVEL_NONE - 1;
 
-void logHexDump(Print *output, const char *letter, const char *label, const uint8_t *data, const size_t length) {
-  size_t cnt = 0;
-  size_t step = 0;
-  char limiter = '|';
-  // Use line buffer to speed up output
-  const uint16_t BUFLEN(80);
-  const uint16_t ascOffset(61);
-  char linebuf[BUFLEN];
-  char *cp = linebuf;
-  const char HEXDIGIT[] = "0123456789ABCDEF";
-
-  // Print out header
-  output->printf("[%s] %s: @%08X/%d:\n", letter, label, (uint32_t)data, length);
-
-  // loop over data in steps of 16
-  for (cnt = 0; cnt < length; ++cnt) {
-    step = cnt % 16;
-    // New line?
-    if (step == 0) {
-      // Yes. Clear line and print address header
-      memset(linebuf, ' ', BUFLEN);
-      linebuf[60] = limiter;
-      linebuf[77] = limiter;
-      linebuf[BUFLEN - 1] = 0;
-      snprintf(linebuf, BUFLEN, "  %c %04X: ", limiter, cnt);
-      cp = linebuf + strlen(linebuf);
-      // No, but first block of 8 done?
-    } else if (step == 8) {
-      // Yes, put out additional space
-      cp++;
-    }
-    // Print data byte
-    uint8_t c = data[cnt];
-    *cp++ = HEXDIGIT[(c >> 4) & 0x0F];
-    *cp++ = HEXDIGIT[c & 0x0F];
+// Module levels, all unset
+int8_t MBUmodLvl[LOG_MODULES] = { 0 };
+
+// Format of the suppressed lines report
+#ifdef LOG_COMPACT
+#define LOG_SUPPRESSED "S " LOG_TIME_FMT " %s:%d %u lines suppressed\n"
+#else
+#define LOG_SUPPRESSED "[S] " LOG_TIME_FMT "| %-20s [%4d] %u lines suppressed\n"
+#endif
+
+// Format of the repeated lines report
+#ifdef LOG_COMPACT
+#define LOG_REPEATED "R " LOG_TIME_FMT " last line repeated %u times\n"
+#else
+#define LOG_REPEATED "[R] " LOG_TIME_FMT "| last line repeated %u times\n"
+#endif
+
+// logHeader: format the constant part of a call site's header into the site's buffer
+void logHeader(char *buffer, size_t len, const char *file, int line, const char *func) {
+#ifdef LOG_COMPACT
+  (void)func;
+  snprintf(buffer, len, "%s:%d ", file, line);
+#else
+  snprintf(buffer, len, "%-20s [%4d] %s: ", file, line, func);
+#endif
+}
+
+#ifdef LOG_COLLAPSE
+// State of the line put out last. Concurrent tasks may make the counts inaccurate, but no line
+// different from the one before will be taken as a repetition.
+static std::atomic<uint32_t> logLastKey(0);
+static std::atomic<int> logLastLevel(0);
+static std::atomic<uint32_t> logRepeats(0);
+static std::atomic<uint32_t> logRepeatStart(0);
+
+// logRepeatReport: put out a repetition count, the same way as a regular log line
+static void logRepeatReport(int level, uint32_t count) {
+#ifdef LOG_DEFERRED
+  logDeferred(level, LOG_REPEATED, LOG_TIME, (unsigned int)count);
+#else
+  LogFanout(level).printf(LOG_REPEATED, LOG_TIME, (unsigned int)count);
+#endif
+}
+
+// logRepeated: count a line equal to the one before, or take key as the new last line
+bool logRepeated(int level, uint32_t key) {
+  uint32_t now = millis();
+  // Same as the line before?
+  if (logLastKey.load(std::memory_order_relaxed) == key) {
+    // Yes. Count it, and tell about long runs now and then
+    logRepeats++;
+    if (now - logRepeatStart.load(std::memory_order_relaxed) >= LOG_COLLAPSE_PERIOD) {
+      logRepeatStart = now;
+      uint32_t count = logRepeats.exchange(0);
+      if (count) logRepeatReport(level, count);
+    }
+    return true;
+  }
+  // No. Report the repetitions of the previous line first
+  int lastLevel = logLastLevel.exchange(level);
+  logLastKey = key;
+  logRepeatStart = now;
+  uint32_t count = logRepeats.exchange(0);
+  if (count) logRepeatReport(lastLevel, count);
+  return false;
+}
+
+void logRepeatFlush() {
+  logLastKey = 0;
+  uint32_t count = logRepeats.exchange(0);
+  if (count) logRepeatReport(logLastLevel.load(), count);
+}
+#endif
+
+#ifdef LOG_RATE_LIMIT
+// logSuppressed: report lines a call site has suppressed, the same way as a regular log line
+void logSuppressed(int level, const char *file, int line, uint32_t count) {
+#ifdef LOG_COLLAPSE
+  // The report is a line of its own, so a pending repetition count has to come first
+  logRepeatFlush();
+#endif
+#ifdef LOG_DEFERRED
+  logDeferred(level, LOG_SUPPRESSED, LOG_TIME, file, line, (unsigned int)count);
+#else
+  LogFanout(level).printf(LOG_SUPPRESSED, LOG_TIME, file, line, (unsigned int)count);
+#endif
+}
+#endif
+
+void setModuleLevel(const char *name, int level) {
+  if (!name) return;
+  MBUmodLvl[logModIdx(file_name(name))] = (level < 0) ? 0 : level + 1;
+}
+
+int getModuleLevel(const char *name) {
+  if (!name) return -1;
+  return MBUmodLvl[logModIdx(file_name(name))] - 1;
+}
+
+// The sink registry. Free slots have a nullptr sink, so slots never move while output is written.
+struct LogSink {
+  Print *sink;
+  int level;
+};
+static LogSink logSinks[LOG_MAXSINKS] = { { nullptr, 0 } };
+
+// updateSinkLvl: recalculate the highest sink level
+static void updateSinkLvl() {
+  int lvl = LOG_LEVEL_NONE - 1;
+  for (uint8_t i = 0; i < LOG_MAXSINKS; ++i) {
+    if (logSinks[i].sink && logSinks[i].level > lvl) lvl = logSinks[i].level;
+  }
+  MBUsinkLvl = lvl;
+}
+
+// addLogSink: register a sink or change its level
+bool addLogSink(Print *sink, int level) {
+  if (!sink) return false;
+  LogSink *slot = nullptr;
+  for (uint8_t i = 0; i < LOG_MAXSINKS; ++i) {
+    // Known sink?
+    if (logSinks[i].sink == sink) {
+      // Yes. Only change the level
+      slot = &logSinks[i];
+      break;
+    }
+    // Remember the first free slot
+    if (!slot && !logSinks[i].sink) slot = &logSinks[i];
+  }
+  if (!slot) return false;
+  // Set the level first, so a concurrent writer never sees the sink with a wrong level
+  slot->level = level;
+  slot->sink = sink;
+  updateSinkLvl();
+  return true;
+}
+
+// removeLogSink: free the sink's slot
+bool removeLogSink(Print *sink) {
+  for (uint8_t i = 0; i < LOG_MAXSINKS; ++i) {
+    if (sink && logSinks[i].sink == sink) {
+      logSinks[i].sink = nullptr;
+      updateSinkLvl();
+      return true;
+    }
+  }
+  return false;
+}
+
+// logWrite: fan out a formatted record
+void logWrite(int level, const uint8_t *buffer, size_t size) {
+  if (LOGDEVICE && MBUlogLvl >= level) LOGDEVICE->write(buffer, size);
+  // Any sink interested at all?
+  if (MBUsinkLvl >= level) {
+    // Yes. Find them
+    for (uint8_t i = 0; i < LOG_MAXSINKS; ++i) {
+      Print *sink = logSinks[i].sink;
+      if (sink && logSinks[i].level >= level) sink->write(buffer, size);
+    }
+  }
+}
+
+static const char HEXDIGIT[] = "0123456789ABCDEF";
+
+// hexOut: put out the lowest digits hex digits of value
+static char *hexOut(char *cp, uint32_t value, uint8_t digits) {
+  for (int8_t i = digits - 1; i >= 0; --i) {
+    cp[i] = HEXDIGIT[value & 0x0F];
+    value >>= 4;
+  }
+  return cp + digits;
+}
+
+// strOut: copy a string, bounded by ep
+static char *strOut(char *cp, const char *ep, const char *str) {
+  while (str && *str && cp < ep) *cp++ = *str++;
+  return cp;
+}
+
+HexDumper::HexDumper(Print *output, const char *letter, const char *label, const void *address, size_t length, 
+                     char *buffer, size_t bufLen) :
+  HD_output(output),
+  HD_buf(buffer),
+  HD_bufLen(bufLen),
+  HD_used(0),
+  HD_offset(0),
+  HD_carried(0) {
+  // Use our own buffer, if the caller's is missing or too small
+  if (!HD_buf || HD_bufLen < HD_LINELEN) {
+    HD_buf = HD_lines;
+    HD_bufLen = sizeof(HD_lines);
+  }
+  // Header line: "[letter] label: @address/length:"
+  char num[24];
+  char *cp = HD_buf;
+  char *ep = HD_buf + HD_bufLen - sizeof(num) - 16;
+  *cp++ = '[';
+  cp = strOut(cp, ep, letter);
+  *cp++ = ']';
+  *cp++ = ' ';
+  cp = strOut(cp, ep, label);
+  *cp++ = ':';
+  *cp++ = ' ';
+  *cp++ = '@';
+  cp = hexOut(cp, (uint32_t)(uintptr_t)address, 8);
+  *cp++ = '/';
+  char *np = num + sizeof(num);
+  do {
+    *--np = '0' + length % 10;
+    length /= 10;
+  } while (length);
+  while (np < num + sizeof(num)) *cp++ = *np++;
+  *cp++ = ':';
+  *cp++ = '\n';
+  HD_used = cp - HD_buf;
+}
+
+HexDumper::~HexDumper() {
+  end();
+}
+
+// bufferSize: header plus all lines
+size_t HexDumper::bufferSize(const char *letter, const char *label, size_t length) {
+  return (letter ? strlen(letter) : 0) + (label ? strlen(label) : 0) + 32 + ((length + 15) / 16) * HD_LINELEN;
+}
+
+// add: complete a carried line, dump full lines directly from data and carry the rest
+void HexDumper::add(const uint8_t *data, size_t len) {
+  if (!data) return;
+  while (len) {
+    if (HD_carried || len < 16) {
+      size_t n = 16 - HD_carried;
+      if (n > len) n = len;
+      memcpy(HD_carry + HD_carried, data, n);
+      HD_carried += n;
+      data += n;
+      len -= n;
+      if (HD_carried == 16) {
+        line(HD_carry, 16);
+        HD_carried = 0;
+      }
+    } else {
+      line(data, 16);
+      data += 16;
+      len -= 16;
+    }
+  }
+}
+
+// end: put out what is left
+void HexDumper::end() {
+  if (HD_carried) {
+    line(HD_carry, HD_carried);
+    HD_carried = 0;
+  }
+  flush();
+}
+
+// flush: write the buffer
+void HexDumper::flush() {
+  if (HD_used && HD_output) HD_output->write((const uint8_t *)HD_buf, HD_used);
+  HD_used = 0;
+}
+
+// line: "  | 0000: 3C 3D 3E 3F 40 41 42 43  44 45 46 47 48 49 4A 4B  |<=>?@ABCDEFGHIJK| "
+void HexDumper::line(const uint8_t *data, size_t n) {
+  if (HD_used + HD_LINELEN > HD_bufLen) flush();
+  char *cp = HD_buf + HD_used;
+  *cp++ = ' ';
+  *cp++ = ' ';
+  *cp++ = '|';
+  *cp++ = ' ';
+  cp = hexOut(cp, HD_offset, (HD_offset > 0xFFFF) ? 8 : 4);
+  *cp++ = ':';
+  *cp++ = ' ';
+  // Data bytes in hex, padded for a short line
+  char *ap = cp + 16 * 3 + 3;
+  for (uint8_t i = 0; i < 16; ++i) {
+    if (i == 8) *cp++ = ' ';
+    if (i < n) {
+      uint8_t c = data[i];
+      *cp++ = HEXDIGIT[(c >> 4) & 0x0F];
+      *cp++ = HEXDIGIT[c & 0x0F];
+      ap[i] = (c >= 32 && c < 127) ? c : '.';
+    } else {
+      *cp++ = ' ';
+      *cp++ = ' ';
+      ap[i] = ' ';
+    }
     *cp++ = ' ';
-    if (c >= 32 && c < 127) linebuf[ascOffset + step] = c;
-    else                     linebuf[ascOffset + step] = '.';
-    // Line end?
-    if (step == 15) {
-      // Yes, print line
-      output->println(linebuf);
+  }
+  *cp++ = ' ';
+  *cp++ = '|';
+  // ASCII part
+  cp = ap + 16;
+  *cp++ = '|';
+  *cp++ = ' ';
+  *cp++ = '\r';
+  *cp++ = '\n';
+  HD_used = cp - HD_buf;
+  HD_offset += n;
+}
+
+// logHexDump: render the dump in portions of HD_LINES lines, without a heap buffer
+void logHexDump(Print *output, const char *letter, const char *label, const uint8_t *data, const size_t length) {
+  HexDumper dump(output, letter, label, data, length);
+  dump.add(data, length);
+}
+
+#ifdef LOG_DEFERRED
+#include "RingBuf.h"
+
+// The binary log buffer. Records are never overwritten, new ones are dropped if it is full.
+// It is lock-free between the producers and logDrain(), which is the only consumer.
+static StaticRingBuf<LogWord, LOG_DEFERRED_SIZE, RB_PRESERVE, RB_SPSC> logBuffer;
+static std::atomic<uint32_t> logLostRecords(0);
+// logDrain() may be called by more than one task
+static RB_Lock logDrainLock;
+
+// Any task may log, but RB_SPSC takes a single producer only. The few instructions of copying 
+// a record in are protected by a spinlock (ESP32) or by masking the interrupts (ESP8266) instead of a mutex.
+#if defined(ESP32)
+static portMUX_TYPE logStoreMux = portMUX_INITIALIZER_UNLOCKED;
+#define LOG_STORE_ENTER() portENTER_CRITICAL(&logStoreMux)
+#define LOG_STORE_EXIT() portEXIT_CRITICAL(&logStoreMux)
+#else
+#define LOG_STORE_ENTER() uint32_t savedPS = xt_rsil(15)
+#define LOG_STORE_EXIT() xt_wsr_ps(savedPS)
+#endif
+
+// logStore: add a record atomically, counting it if it does not fit
+bool logStore(const LogWord *record, size_t words) {
+  LOG_STORE_ENTER();
+  bool stored = logBuffer.push_back(record, words);
+  LOG_STORE_EXIT();
+  if (stored) return true;
+  logLostRecords++;
+  return false;
+}
+
+uint32_t logLost() {
+  return logLostRecords.load();
+}
+
+// logFetch: get the next argument of type V from the record
+template <typename V>
+static bool logFetch(const LogWord *&arg, const LogWord *end, V &v) {
+  size_t words = (sizeof(V) + sizeof(LogWord) - 1) / sizeof(LogWord);
+  if (arg + words > end) return false;
+  memcpy(&v, arg, sizeof(V));
+  arg += words;
+  return true;
+}
+
+// logPrint: snprintf() a single conversion with the next argument of type V
+template <typename V>
+static bool logPrint(char *&cp, char *ep, const char *spec, const LogWord *&arg, const LogWord *end) {
+  V v;
+  if (!logFetch(arg, end, v)) return false;
+  int n = snprintf(cp, ep - cp, spec, v);
+  if (n > 0) cp += (n < ep - cp) ? n : (ep - cp - 1);
+  return true;
+}
+
+// logFormat: printf() replacement taking its arguments from the LogWords of a record
+static size_t logFormat(char *buf, size_t len, const char *format, const LogWord *arg, const LogWord *end) {
+  char *cp = buf;
+  char *ep = buf + len;
+  char spec[24];
+
+  while (*format && cp < ep - 1) {
+    // Plain character?
+    if (*format != '%') {
+      *cp++ = *format++;
+      continue;
+    }
+    // Escaped '%'?
+    if (format[1] == '%') {
+      *cp++ = '%';
+      format += 2;
+      continue;
+    }
+    // Collect the conversion specification. '*' widths and precisions are resolved right here
+    char *sp = spec;
+    char *se = spec + sizeof(spec) - 8;
+    *sp++ = *format++;
+    while (*format && strchr("-+ #0", *format) && sp < se) *sp++ = *format++;
+    for (uint8_t part = 0; part < 2; ++part) {
+      if (*format == '*') {
+        int w = 0;
+        if (!logFetch(arg, end, w)) return cp - buf;
+        sp += snprintf(sp, spec + sizeof(spec) - sp, "%d", w);
+        format++;
+      }
+      while (*format >= '0' && *format <= '9' && sp < se) *sp++ = *format++;
+      if (part == 0 && *format == '.') *sp++ = *format++;
+      else break;
     }
+    // Length modifier
+    char lm = 0;
+    while (*format && strchr("hlLzjt", *format) && sp < se) {
+      lm = (lm == 'l' && *format == 'l') ? 'q' : *format;
+      *sp++ = *format++;
+    }
+    char conv = *format;
+    if (!conv) break;
+    *sp++ = *format++;
+    *sp = 0;
+    bool ok = true;
+    switch (conv) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+      switch (lm) {
+      case 'l': ok = logPrint<long>(cp, ep, spec, arg, end); break;
+      case 'q': ok = logPrint<long long>(cp, ep, spec, arg, end); break;
+      case 'z': ok = logPrint<size_t>(cp, ep, spec, arg, end); break;
+      case 'j': ok = logPrint<intmax_t>(cp, ep, spec, arg, end); break;
+      case 't': ok = logPrint<ptrdiff_t>(cp, ep, spec, arg, end); break;
+      default:  ok = logPrint<int>(cp, ep, spec, arg, end); break;
+      }
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      if (lm == 'L') ok = logPrint<long double>(cp, ep, spec, arg, end);
+      else           ok = logPrint<double>(cp, ep, spec, arg, end);
+      break;
+    case 's':
+      ok = logPrint<const char *>(cp, ep, spec, arg, end);
+      break;
+    case 'p':
+      ok = logPrint<void *>(cp, ep, spec, arg, end);
+      break;
+    case 'n':
+      {
+        // Never write anything back - just skip the argument
+        void *dummy;
+        ok = logFetch(arg, end, dummy);
+      }
+      break;
+    default:
+      // Unknown conversion - put it out as is
+      for (sp = spec; *sp && cp < ep - 1; ++sp) *cp++ = *sp;
+      break;
+    }
+    if (!ok) break;
   }
-  // Unfinished line?
-  if (length && step != 15) {
-      // Yes, print line
-      output->println(linebuf);
+  *cp = 0;
+  return cp - buf;
+}
+
+// logDrain: format stored records and print them out
+size_t logDrain(Print *output, size_t maxRecords) {
+  LogWord record[2 + LOG_DEFERRED_MAXARGS];
+  char line[LOG_DEFERRED_LINE];
+  size_t cnt = 0;
+  static uint32_t reported = 0;
+  LOCK_GUARD(lock, logDrainLock);
+
+  // Report records lost since the last call
+  uint32_t lost = logLost();
+  if (lost != reported) {
+    int len = snprintf(line, LOG_DEFERRED_LINE, "[%u deferred log records lost]\n", (unsigned int)(lost - reported));
+    if (output) output->write((const uint8_t *)line, len);
+    else        logWrite(LOG_LEVEL_CRITICAL, (const uint8_t *)line, len);
+    reported = lost;
+  }
+
+  while (!maxRecords || cnt < maxRecords) {
+    // Get the record header first
+    if (logBuffer.safeCopy(record, 2) < 2) break;
+    size_t words = 2 + (record[1] >> 8);
+    // Now fetch the complete record
+    if (logBuffer.safeCopy(record, words, true) < words) break;
+    size_t len = logFormat(line, LOG_DEFERRED_LINE, (const char *)record[0], record + 2, record + words);
+    if (output) output->write((const uint8_t *)line, len);
+    else        logWrite(record[1] & 0xFF, (const uint8_t *)line, len);
+    cnt++;
   }
+  return cnt;
 }
+#endif  // LOG_DEFERRED
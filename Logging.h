@@ -5,6 +5,8 @@
 
 // Include Arduino.h to make Print and Serial known
 #include <Arduino.h>
+#include <type_traits>
+#include <atomic>
 
 #ifndef LOG_LEVEL
 #define LOG_LEVEL LOG_LEVEL_ERROR
@@ -34,7 +36,30 @@
 #define LL_CYAN "\e[36m"
 #define LL_NORM "\e[0m"
 
-#define LOG_HEADER(x) "[" #x "] %lu| %-20s [%4d] %s: "
+// Timestamps: milliseconds since start by default. With LOG_TIME_US defined, the 64 bit microseconds
+// of Tick::us64() are used instead, for traces with finer resolution that do not wrap around.
+#ifdef LOG_TIME_US
+#include "Tick.h"
+#define LOG_TIME_FMT "%llu"
+#define LOG_TIME ((unsigned long long)Tick::us64())
+#else
+#define LOG_TIME_FMT "%lu"
+#define LOG_TIME ((unsigned long)millis())
+#endif
+
+// Compact headers: with LOG_COMPACT defined, a line starts with "<level> <time> <file>:<line> " only,
+// without padding, function name and colours, to save bandwidth on slow links
+#ifdef LOG_COMPACT
+#define LOG_HEADER(x) #x " " LOG_TIME_FMT " %s"
+#define LOG_RED ""
+#define LOG_YELLOW ""
+#define LOG_NORM ""
+#else
+#define LOG_HEADER(x) "[" #x "] " LOG_TIME_FMT "| %s"
+#define LOG_RED LL_RED
+#define LOG_YELLOW LL_YELLOW
+#define LOG_NORM LL_NORM
+#endif
 
 constexpr const char* str_end(const char *str) {
     return *str ? str_end(str + 1) : str;
@@ -51,9 +76,332 @@ constexpr const char* file_name(const char* str) {
     return str_slant(str) ? r_slant(str_end(str)) : str;
 }
 
+// Per-module runtime levels. A module is a source file - or whatever LOG_MODULE was defined to before
+// including Logging.h. Its name is hashed at compile time into one of LOG_MODULES slots of MBUmodLvl.
+// A module level >= 0 will let the module's output up to that level pass to all log devices.
+// Please note that different modules may share a slot, if their names happen to have the same hash.
+#ifndef LOG_MODULES
+#define LOG_MODULES 32
+#endif
+
+// logModHash: FNV-1a hash of a module name, ending at the first '.' to ignore file extensions
+constexpr uint32_t logModHash(const char *str, uint32_t h = 2166136261u) {
+    return (*str && *str != '.') ? logModHash(str + 1, (h ^ (uint8_t)*str) * 16777619u) : h;
+}
+constexpr uint8_t logModIdx(const char *str) {
+    return logModHash(str) % LOG_MODULES;
+}
+
+#ifdef LOG_MODULE
+#define LOG_TAG LOG_MODULE
+#else
+#define LOG_TAG file_name(__FILE__)
+#endif
+// LOG_MODIDX: the calling module's slot, forced to be a compile time constant
+#define LOG_MODIDX (std::integral_constant<uint8_t, logModIdx(LOG_TAG)>::value)
+
 extern Print *LOGDEVICE;
 extern int MBUlogLvl;
+// logHexDump: put out a formatted hex dump of a memory area. The dump is rendered in HexDumper's
+// line buffer and written in portions of HD_LINES lines, so no heap is used.
 void logHexDump(Print *output, const char *letter, const char *label, const uint8_t *data, const size_t length);
+
+// HexDumper: incremental hex dump. Data may be added in chunks of any size, the dump is collected in 
+// a buffer of HD_LINES lines and written whenever that is full. Alternatively a caller-supplied buffer is used.
+// address and length are only used for the header line, the offsets count the bytes added.
+#define HD_LINES 4
+#define HD_LINELEN 85    // Longest possible line, with 8 hex digits for the offset
+
+class HexDumper {
+public:
+  HexDumper(Print *output, const char *letter, const char *label, const void *address, size_t length, 
+            char *buffer = nullptr, size_t bufLen = 0);
+  ~HexDumper();
+
+  // add: dump the next len bytes
+  void add(const uint8_t *data, size_t len);
+
+  // end: put out an unfinished line and the remainder of the buffer
+  void end();
+
+  // bufferSize: size of a buffer taking the complete dump of length bytes, including the header
+  static size_t bufferSize(const char *letter, const char *label, size_t length);
+
+protected:
+  Print *HD_output;
+  char HD_lines[HD_LINES * HD_LINELEN];
+  char *HD_buf;            // Buffer in use - HD_lines or the caller's
+  size_t HD_bufLen;        // Size of HD_buf
+  size_t HD_used;          // Number of chars in HD_buf
+  size_t HD_offset;        // Number of bytes dumped so far
+  uint8_t HD_carry[16];    // Bytes of an incomplete line
+  uint8_t HD_carried;      // Number of bytes in HD_carry
+
+  // line: render a line of up to 16 bytes into the buffer
+  void line(const uint8_t *data, size_t n);
+  // flush: write the buffer
+  void flush();
+};
+
+// Additional log sinks. Each sink has its own level, independent of MBUlogLvl, which is used for LOGDEVICE.
+// Output is formatted once and then written to LOGDEVICE and all sinks with a sufficient level.
+#ifndef LOG_MAXSINKS
+#define LOG_MAXSINKS 4
+#endif
+
+// MBUsinkLvl: highest level of all sinks. Do not set it directly, it is maintained by the functions below.
+extern int MBUsinkLvl;
+
+// MBUmodLvl: the module levels plus 1, so 0 is a module without a level of its own
+extern int8_t MBUmodLvl[LOG_MODULES];
+// setModuleLevel: set the level for the module name ("ModbusServer" or "ModbusServer.cpp"). -1 will remove it.
+void setModuleLevel(const char *name, int level);
+// getModuleLevel: get the level set for the module name, -1 if there is none
+int getModuleLevel(const char *name);
+
+// addLogSink: add a sink with the given level or change the level of a known sink.
+// Returns false if all LOG_MAXSINKS slots are taken.
+bool addLogSink(Print *sink, int level);
+// removeLogSink: stop writing to the sink. Returns false if it was not found.
+bool removeLogSink(Print *sink);
+// logWrite: write a formatted record to LOGDEVICE and all sinks accepting the level
+void logWrite(int level, const uint8_t *buffer, size_t size);
+
+// LOG_GATE: true if the module level or any output device is accepting the level. 
+// Checked before any formatting is done.
+#define LOG_GATE(level) (MBUmodLvl[LOG_MODIDX] > (level) || MBUlogLvl >= (level) || MBUsinkLvl >= (level))
+// Rate limiting: with LOG_RATE_LIMIT defined, each LOG_x call site may put out LOG_RATE_BURST lines
+// in a row, then one more every LOG_RATE_PERIOD milliseconds. Suppressed lines are counted,
+// the count is reported before the next line the call site is allowed to put out.
+// The state is kept in a static LogRate per call site. Concurrent tasks may make the counts inaccurate.
+#ifdef LOG_RATE_LIMIT
+#ifndef LOG_RATE_BURST
+#define LOG_RATE_BURST 10
+#endif
+#ifndef LOG_RATE_PERIOD
+#define LOG_RATE_PERIOD 100
+#endif
+
+// logSuppressed: put out the number of lines a call site has suppressed
+void logSuppressed(int level, const char *file, int line, uint32_t count);
+
+struct LogRate {
+  uint32_t last;         // Time of the last refill
+  uint32_t suppressed;   // Lines suppressed since the last one put out
+  uint16_t spent;        // Number of lines put out from the burst allowance, so 0 is a full bucket
+
+  // pass: true if the call site may put out another line
+  inline bool pass(int level, const char *file, int line) {
+    uint32_t now = millis();
+    uint32_t refill = (now - last) / LOG_RATE_PERIOD;
+    if (refill) {
+      spent = (refill >= spent) ? 0 : spent - refill;
+      last += refill * LOG_RATE_PERIOD;
+    }
+    if (spent >= LOG_RATE_BURST) {
+      suppressed++;
+      return false;
+    }
+    spent++;
+    if (suppressed) {
+      logSuppressed(level, file, line, suppressed);
+      suppressed = 0;
+    }
+    return true;
+  }
+};
+#define LOG_RATE_CHECK(level) if (!logSite.LS_rate.pass(LOG_FILTER(level), file_name(__FILE__), __LINE__)) break;
+#else
+#define LOG_RATE_CHECK(level)
+#endif
+
+// Collapsing: with LOG_COLLAPSE defined, a LOG_x line identical to the one put out before - same
+// call site and same argument values - is only counted. The count is reported as "last line repeated 
+// N times" before the next different line, or every LOG_COLLAPSE_PERIOD milliseconds while it goes on.
+// Lines are told apart by a 32 bit hash of site and arguments, taken before any formatting is done.
+// Strings are hashed by their contents, all other arguments by their values.
+#ifdef LOG_COLLAPSE
+#ifndef LOG_COLLAPSE_PERIOD
+#define LOG_COLLAPSE_PERIOD 10000
+#endif
+
+// logRepeated: true if key is the same as the one of the line before, so the line is not to be put out
+bool logRepeated(int level, uint32_t key);
+// logRepeatFlush: report a pending repetition count now. The next line will be put out in any case.
+void logRepeatFlush();
+
+// logKey: FNV-1a hash of the call site and the arguments of a line
+inline uint32_t logKeyMix(uint32_t h, const void *data, size_t len) {
+  const uint8_t *cp = static_cast<const uint8_t *>(data);
+  while (len--) h = (h ^ *cp++) * 16777619u;
+  return h;
+}
+inline uint32_t logKeyArg(uint32_t h, const char *str) {
+  return str ? logKeyMix(h, str, strlen(str)) : h;
+}
+inline uint32_t logKeyArg(uint32_t h, char *str) {
+  return logKeyArg(h, (const char *)str);
+}
+template <typename T>
+inline uint32_t logKeyArg(uint32_t h, T v) {
+  return logKeyMix(h, &v, sizeof(v));
+}
+inline uint32_t logKey(uint32_t h) {
+  // 0 is the key of "no line yet"
+  return h ? h : 1;
+}
+template <typename T, typename... Args>
+inline uint32_t logKey(uint32_t h, const T &v, const Args&... args) {
+  return logKey(logKeyArg(h, v), args...);
+}
+#define LOG_REPEAT_CHECK(level, ...) if (logRepeated(LOG_FILTER(level), logKey(logKeyArg(2166136261u, (const void *)&logSite), ##__VA_ARGS__))) break;
+#else
+#define LOG_REPEAT_CHECK(level, ...)
+#endif
+
+// LogSite: static data of a LOG_x call site. The constant part of the header - file name, line and
+// function - is formatted by logHeader() when the call site puts out its first line, and kept in the 
+// site's LS_text. That is sized at compile time from the header format, so no heap is needed.
+// So a line only needs the time to be formatted besides the arguments. As the header is static, 
+// it may be used with LOG_DEFERRED as well.
+void logHeader(char *buffer, size_t len, const char *file, int line, const char *func);
+
+// logStrLen, logDigits: compile time length of a string and of a decimal number
+constexpr size_t logStrLen(const char *str) {
+  return *str ? 1 + logStrLen(str + 1) : 0;
+}
+constexpr size_t logDigits(int n) {
+  return (n < 10) ? 1 : 1 + logDigits(n / 10);
+}
+constexpr size_t logPadded(size_t len, size_t width) {
+  return (len < width) ? width : len;
+}
+
+// LOG_SITE_LEN: buffer size for the formatted header, flen and fnlen are the lengths of file and function name.
+// It has to match the formats in logHeader().
+#ifdef LOG_COMPACT
+#define LOG_SITE_LEN(flen, line, fnlen) ((flen) + 1 + logDigits(line) + 1 + 1)
+#else
+#define LOG_SITE_LEN(flen, line, fnlen) (logPadded(flen, 20) + 2 + logPadded(logDigits(line), 4) + 2 + (fnlen) + 2 + 1)
+#endif
+
+template <size_t N>
+struct LogSite {
+  std::atomic<bool> LS_ready;            // LS_text has been formatted
+  char LS_text[N];                       // Formatted header
+#ifdef LOG_RATE_LIMIT
+  LogRate LS_rate;                       // Rate limiter state
+#endif
+
+  // header: get the call site's header, formatting it if not done yet.
+  // Tasks coming in concurrently before the first line is done will all write the same text.
+  inline const char *header(const char *file, int line, const char *func) {
+    if (!LS_ready.load(std::memory_order_acquire)) {
+      logHeader(LS_text, N, file, line, func);
+      LS_ready.store(true, std::memory_order_release);
+    }
+    return LS_text;
+  }
+};
+// LogSite is zero-initialized, so no guard is required for the static instance
+#define LOG_SITE static LogSite<LOG_SITE_LEN(logStrLen(file_name(__FILE__)), __LINE__, sizeof(__func__) - 1)> logSite;
+#define LOG_SITE_HEADER logSite.header(file_name(__FILE__), __LINE__, __func__)
+
+// Instrumentation: with PROF_ENABLE and PROF_LOG defined, the time each LOG_x call site takes to
+// put out a line is measured. The call sites are reported by file name and line.
+#if defined(PROF_ENABLE) && defined(PROF_LOG)
+#include "Instrument.h"
+#define LOG_PROF_SCOPE static ProfSite logProf(file_name(__FILE__), __LINE__); ProfTimer logProfTimer(logProf);
+#else
+#define LOG_PROF_SCOPE
+#endif
+
+// LOG_FILTER: the level the output devices will see. Output let pass by the module level is written to all of them.
+#define LOG_FILTER(level) ((MBUmodLvl[LOG_MODIDX] > (level)) ? LOG_LEVEL_NONE : (level))
+
+// LogFanout: a Print that is formatting into a single buffer, which is sent to all devices by logWrite().
+class LogFanout : public Print {
+public:
+  explicit LogFanout(int level) : LF_level(level) {}
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t size) { logWrite(LF_level, buffer, size); return size; }
+  // self: address of a temporary LogFanout, to be passed to functions taking a Print *
+  inline Print *self() { return this; }
+protected:
+  int LF_level;
+};
+
+#ifdef LOG_DEFERRED
+// Deferred logging: the LOG_* and LOGRAW_* macros do not format anything, but store the format string
+// address, the level and the raw argument values in a binary log buffer. Formatting and output 
+// is done later by logDrain(), called from the loop or a background task.
+// WARNING! Only addresses are stored, so all format strings and all %s arguments must be static!
+
+// Size of the binary log buffer in LogWords
+#ifndef LOG_DEFERRED_SIZE
+#define LOG_DEFERRED_SIZE 1024
+#endif
+
+// Maximum number of LogWords the arguments of a single record may occupy
+#ifndef LOG_DEFERRED_MAXARGS
+#define LOG_DEFERRED_MAXARGS 24
+#endif
+
+// Maximum length of a formatted line
+#ifndef LOG_DEFERRED_LINE
+#define LOG_DEFERRED_LINE 256
+#endif
+
+typedef uintptr_t LogWord;
+
+// LogArg: type an argument will be stored as - as printf() would see it - and the number of LogWords it takes
+template <typename T>
+struct LogArg {
+  typedef typename std::decay<T>::type D;
+  typedef typename std::conditional<std::is_same<D, float>::value, double,
+          typename std::conditional<(std::is_integral<D>::value || std::is_enum<D>::value) && sizeof(D) < sizeof(int), int,
+          D>::type>::type type;
+  static constexpr size_t words = (sizeof(type) + sizeof(LogWord) - 1) / sizeof(LogWord);
+};
+
+// LogWords: number of LogWords taken by a list of arguments
+template <typename... Args> struct LogWords;
+template <> struct LogWords<> { static constexpr size_t value = 0; };
+template <typename T, typename... Args> struct LogWords<T, Args...> { 
+  static constexpr size_t value = LogArg<T>::words + LogWords<Args...>::value;
+};
+
+// logPack: copy the arguments into the LogWords of a record
+inline void logPack(LogWord *) {}
+template <typename T, typename... Args>
+inline void logPack(LogWord *w, T v, Args... args) {
+  typename LogArg<T>::type p = v;
+  memcpy(w, &p, sizeof(p));
+  logPack(w + LogArg<T>::words, args...);
+}
+
+// logStore: add a complete record to the binary log buffer. Returns false if the buffer was full.
+bool logStore(const LogWord *record, size_t words);
+
+// logDeferred: build a record on the stack and store it in one go
+// A record is the format string address, a word with argument size and level, and the argument words.
+template <typename... Args>
+inline void logDeferred(int level, const char *format, Args... args) {
+  static_assert(LogWords<Args...>::value <= LOG_DEFERRED_MAXARGS, "Too many arguments for deferred logging");
+  LogWord record[2 + LogWords<Args...>::value];
+  record[0] = (LogWord)format;
+  record[1] = (LogWord)((LogWords<Args...>::value << 8) | (level & 0xFF));
+  logPack(record + 2, args...);
+  logStore(record, 2 + LogWords<Args...>::value);
+}
+
+// logDrain: format and print out up to maxRecords (0: all) stored records. Returns the number of records printed.
+// The records are sent to LOGDEVICE and the sinks by their levels, or all to output instead, if given.
+size_t logDrain(Print *output = nullptr, size_t maxRecords = 0);
+
+// logLost: number of records that did not fit into the binary log buffer
+uint32_t logLost();
+#endif  // LOG_DEFERRED
 #endif  // _MODBUS_LOGGING
 
 // The remainder may need to be redefined if LOCAL_LOG_LEVEL was set differently before
@@ -89,13 +437,24 @@ void logHexDump(Print *output, const char *letter, const char *label, const uint
 #endif
 
 // Now we can define the macros based on LOCAL_LOG_LEVEL
-#define LOG_LINE_C(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(LL_RED LOG_HEADER(x) format LL_NORM, millis(), file_name(__FILE__), __LINE__, __func__, ##__VA_ARGS__)
-#define LOG_LINE_E(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(LL_YELLOW LOG_HEADER(x) format LL_NORM, millis(), file_name(__FILE__), __LINE__, __func__, ##__VA_ARGS__)
-#define LOG_LINE_T(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(LOG_HEADER(x) format, millis(), file_name(__FILE__), __LINE__, __func__, ##__VA_ARGS__)
-#define LOG_RAW_C(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(LL_RED format LL_NORM, ##__VA_ARGS__)
-#define LOG_RAW_E(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(LL_YELLOW format LL_NORM, ##__VA_ARGS__)
-#define LOG_RAW_T(level, x, format, ...) if (MBUlogLvl >= level) LOGDEVICE->printf(format, ##__VA_ARGS__)
-#define HEX_DUMP_T(x, level, label, address, length) if (MBUlogLvl >= level) logHexDump(LOGDEVICE, #x, label, address, length)
+#ifdef LOG_DEFERRED
+#define LOG_LINE_C(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE logDeferred(LOG_FILTER(level), LOG_RED LOG_HEADER(x) format LOG_NORM, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_LINE_E(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE logDeferred(LOG_FILTER(level), LOG_YELLOW LOG_HEADER(x) format LOG_NORM, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_LINE_T(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE logDeferred(LOG_FILTER(level), LOG_HEADER(x) format, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_RAW_C(level, x, format, ...) if (LOG_GATE(level)) logDeferred(LOG_FILTER(level), LOG_RED format LOG_NORM, ##__VA_ARGS__)
+#define LOG_RAW_E(level, x, format, ...) if (LOG_GATE(level)) logDeferred(LOG_FILTER(level), LOG_YELLOW format LOG_NORM, ##__VA_ARGS__)
+#define LOG_RAW_T(level, x, format, ...) if (LOG_GATE(level)) logDeferred(LOG_FILTER(level), format, ##__VA_ARGS__)
+// Hex dumps cannot be deferred, as the data may be gone. Pending records are put out first to keep the order.
+#define HEX_DUMP_T(x, level, label, address, length) if (LOG_GATE(level)) (logDrain(), logHexDump(LogFanout(LOG_FILTER(level)).self(), #x, label, address, length))
+#else
+#define LOG_LINE_C(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE LogFanout(LOG_FILTER(level)).printf(LOG_RED LOG_HEADER(x) format LOG_NORM, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_LINE_E(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE LogFanout(LOG_FILTER(level)).printf(LOG_YELLOW LOG_HEADER(x) format LOG_NORM, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_LINE_T(level, x, format, ...) do { if (LOG_GATE(level)) { LOG_SITE LOG_RATE_CHECK(level) LOG_REPEAT_CHECK(level, ##__VA_ARGS__) LOG_PROF_SCOPE LogFanout(LOG_FILTER(level)).printf(LOG_HEADER(x) format, LOG_TIME, LOG_SITE_HEADER, ##__VA_ARGS__); } } while (0)
+#define LOG_RAW_C(level, x, format, ...) if (LOG_GATE(level)) LogFanout(LOG_FILTER(level)).printf(LOG_RED format LOG_NORM, ##__VA_ARGS__)
+#define LOG_RAW_E(level, x, format, ...) if (LOG_GATE(level)) LogFanout(LOG_FILTER(level)).printf(LOG_YELLOW format LOG_NORM, ##__VA_ARGS__)
+#define LOG_RAW_T(level, x, format, ...) if (LOG_GATE(level)) LogFanout(LOG_FILTER(level)).printf(format, ##__VA_ARGS__)
+#define HEX_DUMP_T(x, level, label, address, length) if (LOG_GATE(level)) logHexDump(LogFanout(LOG_FILTER(level)).self(), #x, label, address, length)
+#endif
 
 #if LOCAL_LOG_LEVEL >= LOG_LEVEL_NONE
 #define LOG_N(format, ...) LOG_LINE_T(LOG_LEVEL_NONE, N, format, ##__VA_ARGS__)
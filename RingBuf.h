@@ -9,32 +9,80 @@
 #define USE_MUTEX 1
 #endif
 
+// RB_NoLock: stand-in for a mutex where no locking is required
+struct RB_NoLock {
+  inline void lock() {}
+  inline void unlock() {}
+  inline bool try_lock() { return true; }
+};
+
 #if USE_MUTEX
 #include <mutex>   // NOLINT
 using std::mutex;
 using std::lock_guard;
-#define LOCK_GUARD(x,y) std::lock_guard<std::mutex> x(y);
+typedef std::mutex RB_Lock;
+#define LOCK_GUARD(x,y) std::lock_guard<decltype(y)> x(y);
 #else
+typedef RB_NoLock RB_Lock;
 #define LOCK_GUARD(x, y)
 #endif
 
 #include <Arduino.h>
 #include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+// Concurrency modes for RingBuf
+// RB_LOCKED: all modifying operations are protected by a mutex on the ESP32 (default)
+// RB_SPSC:   lock-free single producer/single consumer. Exactly one task may push_back(), 
+//            exactly one other task may read and pop(). A full buffer will never discard 
+//            old elements, new ones are rejected instead (as with preserve=true)
+// RB_NOLOCK: no locking at all. The user has to serialize all accesses, f.i. if several
+//            operations have to be done atomically anyway
+enum RB_Mode : uint8_t { RB_LOCKED = 0, RB_SPSC, RB_NOLOCK };
+
+// Strategies for a full buffer
+// RB_RUNTIME:   decided by the preserve argument to the constructor (default)
+// RB_PRESERVE:  new elements are rejected
+// RB_OVERWRITE: the oldest elements are discarded to make room
+enum RB_Policy : uint8_t { RB_RUNTIME = 0, RB_PRESERVE, RB_OVERWRITE };
+
+// RB_Storage: inline element storage for buffers with a compile-time size N. 
+// For the default N == 0, the buffer is allocated on the heap instead.
+template <typename T, size_t N>
+struct RB_Storage {
+  T RB_store[N];
+  inline T *store() { return RB_store; }
+};
+
+template <typename T>
+struct RB_Storage<T, 0> {
+  inline T *store() { return nullptr; }
+};
 
 // RingBuf implements a circular buffer of chosen size.
+// Head and tail indices wrap around, so push_back() and pop() are O(1) regardless of fill level.
+// T may be any default-constructible, copy- or move-assignable type. Elements are assigned into
+// the buffer slots, which is a plain memcpy for trivially copyable types. Slots of other types
+// are reset to T() when their elements are removed, to release what these may hold.
 // No exceptions thrown at all. Memory allocation failures will result in a const
 // buffer pointing to the static "nilBuf"!
-// template <typename T>
-template <typename T>
-class RingBuf {
+// If a size N is given as template parameter, the buffer is held inline in the object instead,
+// its size is a compile time constant and no memory is allocated at all (see StaticRingBuf below).
+template <typename T, RB_Mode MODE = RB_LOCKED, size_t N = 0, RB_Policy POLICY = RB_RUNTIME>
+class RingBuf : protected RB_Storage<T, N> {
+  static_assert(!(MODE == RB_SPSC && POLICY == RB_OVERWRITE), "RB_SPSC buffers cannot overwrite old data");
 public:
 // Fallback static minimal buffer if memory allocation failed etc.
   static const T nilBuf[2];
 
 // Constructor
-// size: required size in T elements
+// size: required size in T elements. Ignored if N was given.
 // preserve: if true, no more elements will be added to a full buffer unless older elements are consumed
 //           if false, buffer will be rotated until the newest element is added
+//           Ignored unless POLICY is RB_RUNTIME.
   explicit RingBuf(size_t size = 256, bool preserve = false);
 
   // Destructor: takes care of cleaning up the buffer
@@ -58,8 +106,21 @@ public:
   size_t size();
 
   // data: get start address of the elements in buffer
+  // If the used area currently wraps around the buffer end, it is rotated to be contiguous first.
+  // This is O(size()) in that case - use spans() to avoid this.
+  // In RB_SPSC mode data is never moved, so only the first span is contiguous!
   const T *data();
 
+  // Span: a contiguous part of the used buffer area
+  struct Span {
+    const T *data;
+    size_t size;
+  };
+
+  // spans: get the used area as up to two contiguous spans. second.size is 0 if the area does not wrap.
+  // returns the total number of elements in both spans
+  size_t spans(Span &first, Span &second);
+
   // empty: returns true if no elements are in the buffer
   bool empty();
 
@@ -68,6 +129,10 @@ public:
   bool valid();
   operator bool();
 
+  // consistent: plausibility check of the internal state. Meant for buffers in memory
+  // that survives a reset and is not initialized again (see LogHistory).
+  bool consistent();
+
   // capacity: return number of unused elements in buffer
   // WARNING! due to the nature of the rolling buffer, this size is VOLATILE and needs to be 
   //          read again every time the buffer is used! Else data may be missed.
@@ -80,7 +145,7 @@ public:
   size_t pop(size_t numElements);
 
   // operator[]: return the element the index is pointing to. If index is
-  // outside the currently used area, return 0
+  // outside the currently used area, return T() (0 for numbers)
   const T operator[](size_t index);
 
   // safeCopy: get a stable data copy from currently used buffer
@@ -92,9 +157,45 @@ public:
 
   // push_back: add a single element or a buffer of elements to the end of the buffer. 
   // If there is not enough room, the buffer will be rolled until the added elements will fit.
-  bool push_back(const T c);
+  bool push_back(const T &c);
+  bool push_back(T &&c);
   bool push_back(const T *data, size_t size);
 
+  // emplace_back: add an element constructed from args
+  template <typename... Args>
+  bool emplace_back(Args&&... args);
+
+  // pop_front: move the first element into target and remove it. Returns false if the buffer is empty.
+  bool pop_front(T &target);
+
+  // Zero-copy producer API: reserve() a contiguous area of free elements, fill it in place
+  // and make the elements part of the buffer with commit().
+  // reserve: n is the number of elements wanted. On return it holds the number of contiguous free 
+  //          elements actually available, which may be less (or 0, which will return nullptr).
+  //          reserve() never discards data to make room.
+  // commit: add the leading numElements of the reserved area to the buffer.
+  // Only one reservation may be open at a time, and no other push_back() may happen in between!
+  T *reserve(size_t &n);
+  bool commit(size_t numElements);
+
+  // Zero-copy consumer API: peekContiguous() returns the address of the first contiguous run
+  // of used elements after skipping the leading skip elements. len will receive the length of the run.
+  // The elements are valid until they are released with consume(), which is a synonym for pop().
+  // Note that in a non-preserving RB_LOCKED buffer new data may overwrite them in the meantime!
+  const T *peekContiguous(size_t &len, size_t skip = 0);
+  inline size_t consume(size_t numElements) { return pop(numElements); }
+
+  // gather: hand the leading elements, up to maxElements, to sink in contiguous runs and remove
+  // what sink has taken - all under a single lock. sink is called as size_t sink(const T *data, size_t len)
+  // and returns the number of elements it took. gather() stops at the first run not taken completely.
+  // Returns the number of elements removed. Note that writers are held until sink is done!
+  template <typename F>
+  size_t gather(F sink, size_t maxElements = SIZE_MAX);
+
+  // drainTo: write the leading bytes, up to maxElements, to a Print and remove what was written.
+  // For buffers of byte-sized elements only.
+  size_t drainTo(Print &out, size_t maxElements = SIZE_MAX);
+
   // Equality comparison: are sizes and contents of two buffers identical?
   bool operator==(RingBuf &r);
 
@@ -107,109 +208,162 @@ public:
     using pointer           = T*;
     using reference         = T&;
 
-    explicit Iterator(pointer ptr) : m_ptr(ptr) {}
+    Iterator(pointer ptr, pointer lo, pointer hi, size_t left) : m_ptr(ptr), m_lo(lo), m_hi(hi), m_left(left) {}
 
     reference operator*() const { return *m_ptr; }
     pointer operator->() { return m_ptr; }
-    Iterator& operator++() { m_ptr++; return *this; }  
+    Iterator& operator++() { if (++m_ptr == m_hi) m_ptr = m_lo; m_left--; return *this; }  
     Iterator operator++(int) { Iterator tmp = *this; ++(*this); return tmp; }
-    friend bool operator== (const Iterator& a, const Iterator& b) { return a.m_ptr == b.m_ptr; };
-    friend bool operator!= (const Iterator& a, const Iterator& b) { return a.m_ptr != b.m_ptr; };  
+    friend bool operator== (const Iterator& a, const Iterator& b) { return a.m_left == b.m_left; };
+    friend bool operator!= (const Iterator& a, const Iterator& b) { return a.m_left != b.m_left; };  
 
     private:
-      pointer m_ptr;
+      pointer m_ptr;    // Current element
+      pointer m_lo;     // Start of the underlying buffer
+      pointer m_hi;     // End of the underlying buffer, to wrap around
+      size_t m_left;    // Number of elements left to visit
   };
 
   // Provide begin() and end()
-  Iterator begin() { return Iterator(RB_begin); }
-  Iterator end()   { return Iterator(RB_end); }
+  Iterator begin() { return Iterator(slot(head()), RB_buffer, RB_buffer + usable(), size()); }
+  Iterator end()   { return Iterator(slot(tail()), RB_buffer, RB_buffer + usable(), 0); }
 
-  // bufferAdr: return the start address of the underlying, double-sized data buffer.
+  // bufferAdr: return the start address of the underlying data buffer.
   // bufferSize: return the real length of the underlying data buffer.
   // Note that this is only sensible in a debug context!
   inline const uint8_t *bufferAdr() { return (uint8_t *)RB_buffer; }
   inline const size_t bufferSize() { return RB_len * RB_elementSize; }
 
 protected:
-  T *RB_buffer;           // The data buffer proper (twice the requested size)
-  T *RB_begin;            // Pointer to the first element currently used
-  T *RB_end;              // Pointer behind the last element currently used
-  size_t RB_len;                // Real length of buffer (twice the requested size)
+  T *RB_buffer;           // The data buffer proper
+  std::atomic<size_t> RB_head;  // Index of the first element currently used, written by the consumer
+  std::atomic<size_t> RB_tail;  // Index behind the last element currently used, written by the producer
+  size_t RB_len;                // Real length of buffer
   size_t RB_usable;             // Requested length of the buffer
   bool RB_preserve;             // Flag to hold or discard the oldest elements if elements are added
-  size_t RB_elementSize;        // Size of a single buffer element
-#if USE_MUTEX
-  std::mutex m;              // Mutex to protect pop, clear and push_back operations
-#endif
+  static constexpr size_t RB_elementSize = sizeof(T);  // Size of a single buffer element
+  static constexpr bool RB_trivial = std::is_trivially_copyable<T>::value;  // Plain data?
+  // Mutex to protect pop, clear and push_back operations. Only used in RB_LOCKED mode.
+  typename std::conditional<MODE == RB_LOCKED, RB_Lock, RB_NoLock>::type m;
   void setFail();            // Internal function to set the object to nilBuf
-  void moveFront(size_t numElements); // Move buffer far left internally
+
+  // Index access. The producer publishes RB_tail, the consumer RB_head with release semantics,
+  // so the element data is visible to the other side before the index move is.
+  inline size_t head() const { return RB_head.load(std::memory_order_acquire); }
+  inline size_t tail() const { return RB_tail.load(std::memory_order_acquire); }
+  inline void setHead(size_t i) { RB_head.store(i, std::memory_order_release); }
+  inline void setTail(size_t i) { RB_tail.store(i, std::memory_order_release); }
+  // preserving: true if a full buffer has to reject new elements. Always the case in RB_SPSC mode,
+  // as only the consumer may move RB_head.
+  inline bool preserving() const {
+    return (MODE == RB_SPSC) || (POLICY == RB_PRESERVE) || (POLICY == RB_RUNTIME && RB_preserve);
+  }
+  // usable: number of elements the buffer can hold. A constant if N was given.
+  inline size_t usable() const { return N ? N : RB_usable; }
+
+  // Index helpers. RB_head and RB_tail run over [0, 2 * RB_usable), so a full buffer
+  // (distance RB_usable) can be told apart from an empty one (distance 0) without a spare slot.
+  // used: number of elements between two indices
+  inline size_t used(size_t h, size_t t) const { return (t >= h) ? t - h : t + 2 * usable() - h; }
+  // advance: move an index forward by n elements (n <= RB_usable)
+  inline size_t advance(size_t i, size_t n) const { i += n; return (i >= 2 * usable()) ? i - 2 * usable() : i; }
+  // offset: position of an index in RB_buffer
+  inline size_t offset(size_t i) const { return (i >= usable()) ? i - usable() : i; }
+  // slot: address of the element an index is pointing to
+  inline T *slot(size_t i) const { return RB_buffer + offset(i); }
+  // copyIn: copy numElements elements into the buffer, starting at index i. Handles the wrap-around.
+  void copyIn(size_t i, const T *source, size_t numElements);
+  // copyOut: copy numElements elements from the buffer, starting at index i. Handles the wrap-around.
+  // move: move the elements instead of copying them
+  void copyOut(size_t i, T *target, size_t numElements, bool move = false);
+  // release: reset numElements slots starting at index i to T(), unless T is trivially copyable
+  void release(size_t i, size_t numElements);
+  // put: add a single element, copied or moved in
+  template <typename U>
+  bool put(U &&c);
 };
 
-template <typename T>
-const T  RingBuf<T>::nilBuf[2] = { 0, 0 };
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+const T  RingBuf<T, MODE, N, POLICY>::nilBuf[2] = { T(), T() };
 
 // setFail: in case of memory allocation problems, use static nilBuf 
-template <typename T>
-void RingBuf<T>::setFail() {
-  RB_buffer = (T *)RingBuf<T>::nilBuf;
-  RB_len = 2 * RB_elementSize;
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+void RingBuf<T, MODE, N, POLICY>::setFail() {
+  RB_buffer = (T *)RingBuf<T, MODE, N, POLICY>::nilBuf;
+  RB_len = 2;
   RB_usable = 0;
-  RB_begin = RB_end = RB_buffer;
+  setHead(0);
+  setTail(0);
 }
 
 // valid: return if buffer is a real one
-template <typename T>
-bool RingBuf<T>::valid() {
-  return (RB_buffer && (RB_buffer != RingBuf<T>::nilBuf));
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::valid() {
+  // Inline buffers are always valid
+  if (N) return true;
+  return (RB_buffer && (RB_buffer != RingBuf<T, MODE, N, POLICY>::nilBuf));
+}
+
+// consistent: check if indices, sizes and buffer address make sense
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::consistent() {
+  // Inline buffers must point to their own storage
+  if (N && (RB_buffer != this->store() || RB_len != N)) return false;
+  if (!valid()) return false;
+  size_t h = head();
+  size_t t = tail();
+  if (h >= 2 * usable() || t >= 2 * usable()) return false;
+  return used(h, t) <= usable();
 }
 
 // operator bool: same as valid()
-template <typename T>
-RingBuf<T>::operator bool() {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>::operator bool() {
   return valid();
 }
 
-// Constructor: allocate a buffer twice the requested size
-template <typename T>
-RingBuf<T>::RingBuf(size_t size, bool p) :
-  RB_len(size),
-  RB_usable(size),
-  RB_preserve(p),
-  RB_elementSize(sizeof(T)) {
-  // Allocate memory
-  RB_buffer = new T[RB_len];
+// Constructor: allocate a buffer of the requested size, or use the inline storage
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>::RingBuf(size_t size, bool p) :
+  RB_head(0),
+  RB_tail(0),
+  RB_len(N ? N : size),
+  RB_usable(N ? N : size),
+  RB_preserve(p) {
+  // Allocate memory, if not inline
+  if (N) RB_buffer = this->store();
+  else   RB_buffer = size ? new T[RB_len] : nullptr;
   // Failed?
   if (!RB_buffer) setFail();
   else clear();
 }
 
 // Destructor: free allocated memory, if any
-template <typename T>
-RingBuf<T>::~RingBuf() {
-  // Do we have a valid buffer?
-  if (valid()) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>::~RingBuf() {
+  // Do we have a valid, allocated buffer?
+  if (!N && valid()) {
     // Yes, free it
-    delete RB_buffer;
+    delete[] RB_buffer;
   }
 }
 
 // Copy constructor: take over everything
-template <typename T>
-RingBuf<T>::RingBuf(const RingBuf &r) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>::RingBuf(const RingBuf &r) {
   // Is the assigned RingBuf valid?
-  if (r.RB_buffer && (r.RB_buffer != RingBuf<T>::nilBuf)) {
+  if (N || (r.RB_buffer && (r.RB_buffer != RingBuf<T, MODE, N, POLICY>::nilBuf))) {
     // Yes. Try to allocate a copy
-    RB_buffer = new T[r.RB_len];
+    RB_buffer = N ? this->store() : new T[r.RB_len];
     // Succeeded?
     if (RB_buffer) {
       // Yes. copy over data
       RB_len = r.RB_len;
-      memcpy(RB_buffer, r.RB_buffer, RB_len * r.RB_elementSize);
-      RB_begin = RB_buffer + (r.RB_begin - r.RB_buffer);
-      RB_end = RB_buffer + (r.RB_end - r.RB_buffer);
+      std::copy(r.RB_buffer, r.RB_buffer + RB_len, RB_buffer);
+      setHead(r.head());
+      setTail(r.tail());
       RB_preserve = r.RB_preserve;
-      RB_usable = r.RB_usable;
-      RB_elementSize = r.RB_elementSize;
+      RB_usable = r.usable();
     } else {
       setFail();
     }
@@ -219,18 +373,26 @@ RingBuf<T>::RingBuf(const RingBuf &r) {
 }
 
 // Move constructor
-template <typename T>
-RingBuf<T>::RingBuf(RingBuf &&r) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>::RingBuf(RingBuf &&r) {
+  // Inline buffers cannot be taken over, they need to be copied
+  if (N) {
+    RB_buffer = this->store();
+    RB_len = N;
+    RB_usable = N;
+    RB_preserve = r.RB_preserve;
+    setHead(0);
+    setTail(0);
+    *this = std::move(r);
   // Is the assigned RingBuf valid?
-  if (r.RB_buffer && (r.RB_buffer != RingBuf<T>::nilBuf)) {
+  } else if (r.RB_buffer && (r.RB_buffer != RingBuf<T, MODE, N, POLICY>::nilBuf)) {
     // Yes. Take over the data
     RB_buffer = r.RB_buffer;
     RB_len = r.RB_len;
-    RB_begin = RB_buffer + (r.RB_begin - r.RB_buffer);
-    RB_end = RB_buffer + (r.RB_end - r.RB_buffer);
+    setHead(r.head());
+    setTail(r.tail());
     RB_preserve = r.RB_preserve;
-    RB_usable = r.RB_usable;
-    RB_elementSize = r.RB_elementSize;
+    RB_usable = r.usable();
     r.RB_buffer = nullptr;
   } else {
     setFail();
@@ -238,166 +400,373 @@ RingBuf<T>::RingBuf(RingBuf &&r) {
 }
 
 // Assignment
-template <typename T>
-RingBuf<T>& RingBuf<T>::operator=(const RingBuf<T> &r) {
-  if (valid()) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>& RingBuf<T, MODE, N, POLICY>::operator=(const RingBuf<T, MODE, N, POLICY> &r) {
+  if (valid() && this != &r) {
     // Is the source a real RingBuf?
-    if (r.RB_buffer && (r.RB_buffer != RingBuf<T>::nilBuf)) {
-      // Yes. Copy over the data
+    if (N || (r.RB_buffer && (r.RB_buffer != RingBuf<T, MODE, N, POLICY>::nilBuf))) {
+      // Yes. Copy over the data. 
+      // If the source wraps around, it needs to be pushed in two parts
       clear();
-      push_back(r.RB_begin, r.RB_end - r.RB_begin);
+      size_t h = r.head();
+      size_t n = r.used(h, r.tail());
+      size_t first = r.usable() - r.offset(h);
+      if (first > n) first = n;
+      push_back(r.slot(h), first);
+      if (n > first) push_back(r.RB_buffer, n - first);
     }
   }
   return *this;
 }
 
 // Move assignment
-template <typename T>
-RingBuf<T>& RingBuf<T>::operator=(RingBuf<T> &&r) {
-  if (valid()) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+RingBuf<T, MODE, N, POLICY>& RingBuf<T, MODE, N, POLICY>::operator=(RingBuf<T, MODE, N, POLICY> &&r) {
+  if (valid() && this != &r) {
     // Is the source a real RingBuf?
-    if (r.RB_buffer && (r.RB_buffer != RingBuf<T>::nilBuf)) {
-      // Yes. Copy over the data
+    if (N || (r.RB_buffer && (r.RB_buffer != RingBuf<T, MODE, N, POLICY>::nilBuf))) {
+      // Yes. Move over the elements
       clear();
-      push_back(r.RB_begin, r.RB_end - r.RB_begin);
-      r.RB_buffer = nullptr;
+      size_t h = r.head();
+      size_t n = r.used(h, r.tail());
+      for (size_t i = 0; i < n; ++i) {
+        put(std::move(*r.slot(r.advance(h, i))));
+      }
+      // Release the source's buffer, unless it is inline
+      if (!N) {
+        delete[] r.RB_buffer;
+        r.RB_buffer = nullptr;
+      } else {
+        r.clear();
+      }
     }
   }
   return *this;
 }
 
 // size: number of elements used in the buffer
-template <typename T>
-size_t RingBuf<T>::size() {
-  return RB_end - RB_begin;
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::size() {
+  return used(head(), tail());
 }
 
-// data: get start of used data area
-template <typename T>
-const T *RingBuf<T>::data() {
-  return RB_begin;
+// data: get start of used data area. Rotate the buffer if the used area is wrapping around.
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+const T *RingBuf<T, MODE, N, POLICY>::data() {
+  // The producer may be writing concurrently in RB_SPSC mode, so we may not move data then
+  if (MODE != RB_SPSC && valid()) {
+    LOCK_GUARD(cLock, m);
+    size_t n = size();
+    size_t h = offset(head());
+    // Does the used area wrap?
+    if (h + n > usable()) {
+      // Yes. Rotate the first element to the buffer start
+      std::rotate(RB_buffer, RB_buffer + h, RB_buffer + usable());
+      setHead(0);
+      setTail(n);
+    }
+  }
+  return slot(head());
+}
+
+// spans: get the used area as up to two contiguous spans
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::spans(Span &first, Span &second) {
+  second.data = RB_buffer;
+  second.size = 0;
+  first.data = RB_buffer;
+  first.size = 0;
+  if (!valid()) return 0;
+  LOCK_GUARD(cLock, m);
+  size_t hd = head();
+  size_t n = used(hd, tail());
+  size_t h = offset(hd);
+  first.data = RB_buffer + h;
+  // Does the used area wrap?
+  if (h + n > usable()) {
+    // Yes. The second part starts at the buffer start
+    first.size = usable() - h;
+    second.size = n - first.size;
+  } else {
+    first.size = n;
+  }
+  return n;
 }
 
 // empty: is any data in buffer?
-template <typename T>
-bool RingBuf<T>::empty() {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::empty() {
   return ((size() == 0) || !valid());
 }
 
 // capacity: return remaining usable size
-template <typename T>
-size_t RingBuf<T>::capacity() {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::capacity() {
   if (!valid()) return 0;
-  return RB_usable - size();
+  return usable() - size();
 }
 
 // clear: forget about contents
-template <typename T>
-bool RingBuf<T>::clear() {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::clear() {
   if (!valid()) return false;
-  LOCK_GUARD(cLock, m);
-  RB_begin = RB_end = RB_buffer;
+  if (MODE == RB_SPSC) {
+    // Only the consumer side may be changed here
+    size_t h = head();
+    size_t t = tail();
+    release(h, used(h, t));
+    setHead(t);
+  } else {
+    LOCK_GUARD(cLock, m);
+    size_t h = head();
+    release(h, used(h, tail()));
+    setHead(0);
+    setTail(0);
+  }
   return true;
 }
 
 // pop: remove elements from the beginning of the buffer
-template <typename T>
-size_t RingBuf<T>::pop(size_t numElements) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::pop(size_t numElements) {
   if (!valid()) return 0;
-  // Do we have data in the buffer?
-  if (size()) {
-    // Yes. Is the requested number of elements larger than the used buffer?
-    if (numElements >= size()) {
-      // Yes. clear the buffer
-      size_t n = size();
-      clear();
-      return n;
-    } else {
-      LOCK_GUARD(cLock, m);
-      // No, the buffer needs to be emptied partly only
-      moveFront(numElements);
-    }
-    return numElements;
+  LOCK_GUARD(cLock, m);
+  // Is the requested number of elements larger than the used buffer?
+  size_t h = head();
+  size_t n = used(h, tail());
+  if (numElements > n) {
+    // Yes. Limit to what we have
+    numElements = n;
   }
-  return 0;
+  release(h, numElements);
+  setHead(advance(h, numElements));
+  return numElements;
 }
 
-// moveFront: shift left buffer contents by a given number of elements.
+// copyIn: copy elements into the buffer at index i, wrapping around the buffer end if need be
 // (used internally only)
-template <typename T>
-void RingBuf<T>::moveFront(size_t numElements) {
-  RB_begin += numElements;
-  memmove(RB_buffer, RB_begin, (RB_end - RB_begin) * RB_elementSize);
-  RB_begin = RB_buffer;
-  RB_end -= numElements;
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+void RingBuf<T, MODE, N, POLICY>::copyIn(size_t i, const T *source, size_t numElements) {
+  size_t o = offset(i);
+  size_t first = usable() - o;
+  if (first > numElements) first = numElements;
+  // std::copy will use memmove for trivially copyable types
+  std::copy(source, source + first, RB_buffer + o);
+  if (numElements > first) {
+    std::copy(source + first, source + numElements, RB_buffer);
+  }
 }
 
-// push_back(single element): add one element to the buffer, potentially discarding previous ones
-template <typename T>
-bool RingBuf<T>::push_back(const T c) {
+// copyOut: copy elements from the buffer at index i, wrapping around the buffer end if need be
+// (used internally only)
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+void RingBuf<T, MODE, N, POLICY>::copyOut(size_t i, T *target, size_t numElements, bool move) {
+  size_t o = offset(i);
+  size_t first = usable() - o;
+  if (first > numElements) first = numElements;
+  if (move) {
+    std::move(RB_buffer + o, RB_buffer + o + first, target);
+    if (numElements > first) std::move(RB_buffer, RB_buffer + numElements - first, target + first);
+  } else {
+    std::copy(RB_buffer + o, RB_buffer + o + first, target);
+    if (numElements > first) std::copy(RB_buffer, RB_buffer + numElements - first, target + first);
+  }
+}
+
+// release: reset removed elements, so these will not keep resources until overwritten
+// (used internally only)
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+void RingBuf<T, MODE, N, POLICY>::release(size_t i, size_t numElements) {
+  if (RB_trivial) return;
+  while (numElements--) {
+    *slot(i) = T();
+    i = advance(i, 1);
+  }
+}
+
+// put: add one element to the buffer, potentially discarding previous ones
+// (used internally only)
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+template <typename U>
+bool RingBuf<T, MODE, N, POLICY>::put(U &&c) {
   if (!valid()) return false;
   {
     LOCK_GUARD(cLock, m);
+    size_t t = RB_tail.load(std::memory_order_relaxed);
     // No more space?
-    if (capacity() == 0) {
+    if (used(head(), t) == usable()) {
       // No, we need to drop something
       // Are we to keep the oldest data?
-      if (RB_preserve) {
+      if (preserving()) {
         // Yes. The new element will be dropped to leave the buffer untouched
         return false;
       }
-      // We need to drop the oldest element begin is pointing to
-      moveFront(1);
+      // We need to drop the oldest element head is pointing to
+      setHead(advance(head(), 1));
     }
     // Now add the element
-    *RB_end = c;
-    RB_end++;
+    *slot(t) = std::forward<U>(c);
+    setTail(advance(t, 1));
   }
   return true;
 }
 
+// push_back(single element): copy one element into the buffer
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::push_back(const T &c) {
+  return put(c);
+}
+
+// push_back(single element): move one element into the buffer
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::push_back(T &&c) {
+  return put(std::move(c));
+}
+
+// emplace_back: construct an element and move it into the buffer
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+template <typename... Args>
+bool RingBuf<T, MODE, N, POLICY>::emplace_back(Args&&... args) {
+  return put(T(std::forward<Args>(args)...));
+}
+
+// pop_front: move out the first element and remove it
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::pop_front(T &target) {
+  if (!valid()) return false;
+  LOCK_GUARD(cLock, m);
+  size_t h = head();
+  if (used(h, tail()) == 0) return false;
+  target = std::move(*slot(h));
+  release(h, 1);
+  setHead(advance(h, 1));
+  return true;
+}
+
 // push_back(element buffer): add a batch of elements to the buffer
-template <typename T>
-bool RingBuf<T>::push_back(const T *data, size_t size) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::push_back(const T *data, size_t size) {
   if (!valid()) return false;
   // Do not process nullptr or zero lengths
   if (!data || size == 0) return false;
   // Avoid self-referencing pushes
-  if (data >= RB_buffer && data <= (RB_buffer + RB_len)) return false;
+  if (data >= RB_buffer && data < (RB_buffer + RB_len)) return false;
   {
     LOCK_GUARD(cLock, m);
+    size_t t = RB_tail.load(std::memory_order_relaxed);
+    size_t h = head();
     // Is the size to be added fitting the capacity?
-    if (size > capacity()) {
+    if (size > usable() - used(h, t)) {
       // No. We need to make room first
       // Are we allowed to do that?
-      if (RB_preserve) {
+      if (preserving()) {
         // No. deny the push_back
         return false;
       }
       // Adjust data to the maximum usable size
-      if (size > RB_usable) {
-        data += (size - RB_usable);
-        size = RB_usable;
+      if (size > usable()) {
+        data += (size - usable());
+        size = usable();
       }
-      // Make room for the data
-      moveFront(size - capacity());
+      // Make room for the data by dropping the oldest elements
+      setHead(advance(h, size - (usable() - used(h, t))));
     }
     // Now copy it in
-    memcpy(RB_end, data, size * RB_elementSize);
-    RB_end += size;
+    copyIn(t, data, size);
+    setTail(advance(t, size));
   }
   return true;
 }
 
-// operator[]: return the element the index is pointing to. If index is
-// outside the currently used area, return 0
-template <typename T>
-const T RingBuf<T>::operator[](size_t index) {
+// reserve: get a contiguous free area behind the used elements
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+T *RingBuf<T, MODE, N, POLICY>::reserve(size_t &n) {
+  if (!valid()) {
+    n = 0;
+    return nullptr;
+  }
+  LOCK_GUARD(cLock, m);
+  size_t t = RB_tail.load(std::memory_order_relaxed);
+  size_t avail = usable() - used(head(), t);
+  size_t o = offset(t);
+  // The free area may not run past the buffer end
+  if (avail > usable() - o) avail = usable() - o;
+  if (n > avail) n = avail;
+  return n ? RB_buffer + o : nullptr;
+}
+
+// commit: publish elements written into a reserved area
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::commit(size_t numElements) {
+  if (!valid()) return false;
+  LOCK_GUARD(cLock, m);
+  size_t t = RB_tail.load(std::memory_order_relaxed);
+  // The consumer may have freed more space since reserve(), but never less
+  if (numElements > usable() - used(head(), t)) return false;
+  setTail(advance(t, numElements));
+  return true;
+}
+
+// peekContiguous: get the first contiguous run of used elements behind the leading skip elements
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+const T *RingBuf<T, MODE, N, POLICY>::peekContiguous(size_t &len, size_t skip) {
+  len = 0;
+  if (!valid()) return nullptr;
+  LOCK_GUARD(cLock, m);
+  size_t h = head();
+  size_t n = used(h, tail());
+  if (skip >= n) return nullptr;
+  size_t o = offset(advance(h, skip));
+  len = n - skip;
+  // Stop at the buffer end
+  if (len > usable() - o) len = usable() - o;
+  return RB_buffer + o;
+}
+
+// gather: pass the used area to sink in up to two contiguous runs, then pop what was taken
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+template <typename F>
+size_t RingBuf<T, MODE, N, POLICY>::gather(F sink, size_t maxElements) {
   if (!valid()) return 0;
-  if (index >= 0 && index < size()) {
-    return *(RB_begin + index);
+  LOCK_GUARD(cLock, m);
+  size_t h = head();
+  size_t n = used(h, tail());
+  if (n > maxElements) n = maxElements;
+  size_t done = 0;
+  while (done < n) {
+    size_t o = offset(advance(h, done));
+    size_t len = n - done;
+    // Stop at the buffer end
+    if (len > usable() - o) len = usable() - o;
+    size_t taken = sink(static_cast<const T *>(RB_buffer + o), len);
+    if (taken > len) taken = len;
+    done += taken;
+    // Sink is full?
+    if (taken < len) break;
   }
-  return 0;
+  release(h, done);
+  setHead(advance(h, done));
+  return done;
+}
+
+// drainTo: gather into a Print
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::drainTo(Print &out, size_t maxElements) {
+  static_assert(sizeof(T) == 1, "drainTo() requires byte-sized elements");
+  return gather([&out](const T *data, size_t len) -> size_t {
+    return out.write(reinterpret_cast<const uint8_t *>(data), len);
+  }, maxElements);
+}
+
+// operator[]: return the element the index is pointing to. If index is
+// outside the currently used area, return T()
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+const T RingBuf<T, MODE, N, POLICY>::operator[](size_t index) {
+  if (!valid()) return T();
+  if (index < size()) {
+    return *slot(advance(head(), index));
+  }
+  return T();
 }
 
 // safeCopy: get a stable data copy from currently used buffer
@@ -405,25 +774,49 @@ const T RingBuf<T>::operator[](size_t index) {
 // len: number of elements requested
 // move: if true, copied elements will be pop()-ped
 // returns number of elements actually transferred
-template <typename T>
-size_t RingBuf<T>::safeCopy(T *target, size_t tLen, bool move) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+size_t RingBuf<T, MODE, N, POLICY>::safeCopy(T *target, size_t tLen, bool move) {
   if (!valid()) return 0;
   if (!target) return 0;
   {
     LOCK_GUARD(cLock, m);
-    if (tLen > size()) tLen = size();
-    memcpy(target, RB_begin, tLen * RB_elementSize);
+    size_t h = head();
+    size_t n = used(h, tail());
+    if (tLen > n) tLen = n;
+    // Elements to be dropped can be moved out
+    copyOut(h, target, tLen, move);
+    // Drop the copied elements right away, if requested
+    if (move) {
+      release(h, tLen);
+      setHead(advance(h, tLen));
+    }
   }
-  if (move) pop(tLen);
   return tLen;
 }
 
 // Equality: sizes and contents must be identical
-template <typename T>
-bool RingBuf<T>::operator==(RingBuf<T> &r) {
+template <typename T, RB_Mode MODE, size_t N, RB_Policy POLICY>
+bool RingBuf<T, MODE, N, POLICY>::operator==(RingBuf<T, MODE, N, POLICY> &r) {
   if (!valid() || !r.valid()) return false;
-  if (size() != r.size()) return false;
-  if (memcmp(RB_begin, r.RB_begin, size() * RB_elementSize)) return false;
+  size_t n = size();
+  if (n != r.size()) return false;
+  // Compare chunk-wise, as both buffers may wrap at different positions
+  size_t i = 0;
+  while (i < n) {
+    const T *a = slot(advance(head(), i));
+    const T *b = r.slot(r.advance(r.head(), i));
+    size_t chunk = n - i;
+    if (chunk > (size_t)(RB_buffer + usable() - a)) chunk = RB_buffer + usable() - a;
+    if (chunk > (size_t)(r.RB_buffer + r.usable() - b)) chunk = r.RB_buffer + r.usable() - b;
+    // std::equal will use memcmp for plain numbers
+    if (!std::equal(a, a + chunk, b)) return false;
+    i += chunk;
+  }
   return true;
 }
+// StaticRingBuf: a RingBuf of compile-time size N with inline storage, so it requires no heap
+// memory at all and may be placed in .bss. The strategy for a full buffer is fixed by POLICY as well.
+// Example: StaticRingBuf<uint8_t, 1024> logBuffer;
+template <typename T, size_t N, RB_Policy POLICY = RB_OVERWRITE, RB_Mode MODE = RB_LOCKED>
+using StaticRingBuf = RingBuf<T, MODE, N, POLICY>;
 #endif
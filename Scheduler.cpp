@@ -0,0 +1,87 @@
+// Scheduler
+// Copyright 2020 by miq1@gmx.de
+
+#include "Scheduler.h"
+#include "Tick.h"
+
+Scheduler::Scheduler(uint32_t maxSleep) :
+  SC_count(0),
+  SC_maxSleep(maxSleep) {
+}
+
+int Scheduler::add(TaskFunc task, void *arg) {
+  if (SC_count >= SC_MAXTASKS || !task) return -1;
+  // The task ids are handed out in sequence and never removed, so the new id is SC_count
+  uint8_t i = SC_count++;
+  SC_heap[i] = Entry { Tick::now(), task, arg, i };
+  SC_pos[i] = i;
+  siftUp(i);
+  return i;
+}
+
+// wake: make the task due now and move it up the heap
+void Scheduler::wake(int id) {
+  if (id < 0 || id >= SC_count) return;
+  SC_heap[SC_pos[id]].due = Tick::now();
+  siftUp(SC_pos[id]);
+}
+
+// run: service all due tasks
+uint32_t Scheduler::run() {
+  // All tasks will see the same time in this run
+  Tick::update();
+  if (!SC_count) return SC_maxSleep;
+  uint32_t now = Tick::now();
+  // Service the earliest task as long as it is due
+  while (!before(now, SC_heap[0].due)) {
+    uint32_t due = SC_heap[0].task(SC_heap[0].arg);
+    // Keep the deadline within (now, now + SC_maxSleep]. A task due at once will be 
+    // serviced with the next run(), else we never would get out of here.
+    if (!before(now, due)) {
+      due = now + 1;
+    } else if (before(now + SC_maxSleep, due)) {
+      due = now + SC_maxSleep;
+    }
+    SC_heap[0].due = due;
+    siftDown(0);
+  }
+  return SC_heap[0].due - now;
+}
+
+// loop: service the due tasks and wait for the next
+void Scheduler::loop() {
+  uint32_t wait = run();
+  // Take the time spent in run() into account. Tick has the time run() started at.
+  uint32_t spent = (uint32_t)Tick::ms64() - Tick::now();
+  if (wait > spent) delay(wait - spent);
+}
+
+void Scheduler::swap(uint8_t i, uint8_t j) {
+  Entry e = SC_heap[i];
+  SC_heap[i] = SC_heap[j];
+  SC_heap[j] = e;
+  SC_pos[SC_heap[i].id] = i;
+  SC_pos[SC_heap[j].id] = j;
+}
+
+void Scheduler::siftUp(uint8_t i) {
+  while (i) {
+    uint8_t parent = (i - 1) / 2;
+    if (!before(SC_heap[i].due, SC_heap[parent].due)) break;
+    swap(i, parent);
+    i = parent;
+  }
+}
+
+void Scheduler::siftDown(uint8_t i) {
+  while (true) {
+    uint8_t least = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = left + 1;
+    if (left < SC_count && before(SC_heap[left].due, SC_heap[least].due)) least = left;
+    if (right < SC_count && before(SC_heap[right].due, SC_heap[least].due)) least = right;
+    if (least == i) break;
+    swap(i, least);
+    i = least;
+  }
+}
@@ -0,0 +1,75 @@
+// Scheduler
+// Copyright 2020 by miq1@gmx.de
+//
+// Scheduler services a number of tasks - Blinkers, Buttoners, ButtonGroups, TelnetLogs
+// (the polling variant) or functions of your own - only when they are due. Each task reports the time its next 
+// service is needed, the deadlines are kept in a min-heap. loop() will service the due tasks
+// and delay() until the earliest deadline, so the CPU may idle or sleep in between.
+// 
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+#include <Arduino.h>
+
+// Maximum number of tasks
+#ifndef SC_MAXTASKS
+#define SC_MAXTASKS 16
+#endif
+
+// Default for the longest time a task may wait for its next service
+#define SC_MAXSLEEP 100
+
+class Scheduler {
+public:
+  // A task function services arg and returns the time in ms its next service is due
+  typedef uint32_t (*TaskFunc)(void *arg);
+
+  // Constructor: maxSleep is the longest time any task will wait, even if it reports a
+  // later deadline. This covers changes the scheduler cannot know of, like a Blinker::start().
+  explicit Scheduler(uint32_t maxSleep = SC_MAXSLEEP);
+
+  // add: put a task into the schedule, due at once. Returns a task id or -1 if the schedule is full
+  int add(TaskFunc task, void *arg);
+  // add: schedule anything having update() and nextDue() - Blinker(Bank), Buttoner, ButtonGroup, LogUDP, TelnetLog
+  template<typename T> int add(T &item);
+
+  // wake: have task id serviced with the next run()
+  void wake(int id);
+
+  // run: service all tasks that are due. Returns the time in ms until the next task is due.
+  uint32_t run();
+
+  // loop: run() and delay() until the next task is due. Place it in your loop()
+  void loop();
+
+protected:
+  struct Entry {
+    uint32_t due;                  // Time of the next service
+    TaskFunc task;                 // Function to call
+    void *arg;                     // Argument to it
+    uint8_t id;                    // Task id returned by add()
+  };
+  Entry SC_heap[SC_MAXTASKS];      // Min-heap of deadlines
+  uint8_t SC_pos[SC_MAXTASKS];     // Heap position for each task id
+  uint8_t SC_count;                // Number of tasks
+  uint32_t SC_maxSleep;            // Longest wait for any task
+
+  // before: wrap-safe comparison of times
+  inline static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+  void swap(uint8_t i, uint8_t j);
+  void siftUp(uint8_t i);
+  void siftDown(uint8_t i);
+  // service: adapter calling item's update() and getting its next deadline
+  template<typename T> static uint32_t service(void *arg);
+};
+
+template<typename T> int Scheduler::add(T &item) {
+  return add(service<T>, &item);
+}
+
+template<typename T> uint32_t Scheduler::service(void *arg) {
+  T *item = static_cast<T *>(arg);
+  item->update();
+  return item->nextDue();
+}
+
+#endif
@@ -0,0 +1,131 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "TelnetCommand.h"
+#include <strings.h>
+#include "Logging.h"
+
+// Telnet "interpret as command" and the negotiation verbs followed by one option byte
+#define TC_IAC 255
+#define TC_WILL 251
+
+static const char *levelNames[] = { "none", "critical", "error", "warning", "info", "debug", "verbose" };
+
+// levelName: name of a level, "?" for those out of range
+static const char *levelName(int level) {
+  return (level >= LOG_LEVEL_NONE && level <= LOG_LEVEL_VERBOSE) ? levelNames[level] : "?";
+}
+
+// parseLevel: a digit or a complete level name, in any case. Returns -1 if it is neither.
+static int parseLevel(const char *word) {
+  if (!word) return -1;
+  if (word[0] >= '0' && word[0] <= '6' && !word[1]) return word[0] - '0';
+  for (int i = LOG_LEVEL_NONE; i <= LOG_LEVEL_VERBOSE; ++i) {
+    if (!strcasecmp(word, levelNames[i])) return i;
+  }
+  return -1;
+}
+
+TelnetCommand::TelnetCommand() :
+  TC_len(0),
+  TC_skip(0),
+  TC_ready(false),
+  TC_overflow(false),
+  TC_paused(false) {
+}
+
+size_t TelnetCommand::feed(const uint8_t *data, size_t len) {
+  size_t used = 0;
+  while (used < len && !TC_ready) {
+    uint8_t c = data[used++];
+    // Inside a telnet negotiation?
+    if (TC_skip) {
+      // Yes. An option byte follows WILL, WONT, DO and DONT. Anything else is taken as complete.
+      TC_skip = (TC_skip == 2 && c >= TC_WILL && c < TC_IAC) ? 1 : 0;
+      continue;
+    }
+    if (c == TC_IAC) {
+      TC_skip = 2;
+    } else if (c == '\n') {
+      TC_line[TC_len] = 0;
+      TC_ready = true;
+    } else if (c >= ' ' && c < 0x7F) {
+      if (TC_len < TC_LINELEN - 1) TC_line[TC_len++] = c;
+      else                         TC_overflow = true;
+    }
+  }
+  return used;
+}
+
+TelnetCommand::Action TelnetCommand::execute(Print &out, uint32_t &arg) {
+  Action action = TC_NONE;
+  arg = 0;
+  if (!TC_ready) return action;
+
+  // Split the line into up to three words
+  char *word[3] = { nullptr, nullptr, nullptr };
+  uint8_t words = 0;
+  char *save = nullptr;
+  for (char *w = strtok_r(TC_line, " \t", &save); w && words < 3; w = strtok_r(nullptr, " \t", &save)) {
+    word[words++] = w;
+  }
+
+  if (TC_overflow) {
+    out.printf("Line too long (max. %u characters)\n", TC_LINELEN - 1);
+  } else if (!words) {
+    // Empty line - nothing to do
+  } else if (!strcmp(word[0], "help")) {
+    out.print("help                    this list\n"
+              "level [<level>]         show or set the log level (0..6 or none, critical, ..., verbose)\n"
+              "module <name> [<level>] show or set a module's level, 'off' to remove it\n"
+              "pause | resume          stop or restart the log output to this session\n"
+              "history [<bytes>]       replay the log history\n"
+              "stats                   show the output statistics\n");
+  } else if (!strcmp(word[0], "level")) {
+    if (word[1]) {
+      int level = parseLevel(word[1]);
+      if (level < 0) {
+        out.printf("Unknown level '%s'\n", word[1]);
+      } else {
+        MBUlogLvl = level;
+      }
+    }
+    out.printf("Log level is %d (%s)\n", MBUlogLvl, levelName(MBUlogLvl));
+  } else if (!strcmp(word[0], "module")) {
+    if (!word[1]) {
+      out.print("Module name missing\n");
+    } else {
+      if (word[2]) {
+        int level = strcmp(word[2], "off") ? parseLevel(word[2]) : -1;
+        if (level < 0 && strcmp(word[2], "off")) {
+          out.printf("Unknown level '%s'\n", word[2]);
+        } else {
+          setModuleLevel(word[1], level);
+        }
+      }
+      int level = getModuleLevel(word[1]);
+      if (level < 0) out.printf("Module %s has no level\n", word[1]);
+      else           out.printf("Module %s level is %d (%s)\n", word[1], level, levelName(level));
+    }
+  } else if (!strcmp(word[0], "pause")) {
+    TC_paused = true;
+    out.print("Output paused\n");
+  } else if (!strcmp(word[0], "resume")) {
+    TC_paused = false;
+    out.print("Output resumed\n");
+  } else if (!strcmp(word[0], "history")) {
+    if (word[1]) arg = strtoul(word[1], nullptr, 10);
+    action = TC_HISTORY;
+  } else if (!strcmp(word[0], "stats")) {
+    action = TC_STATS;
+  } else {
+    out.printf("Unknown command '%s' - try 'help'\n", word[0]);
+  }
+
+  // Ready for the next line
+  TC_len = 0;
+  TC_ready = false;
+  TC_overflow = false;
+  return action;
+}
@@ -0,0 +1,54 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+
+#ifndef _TELNETCOMMAND_H
+#define _TELNETCOMMAND_H
+// Include Arduino.h to make Print and Serial known
+#include <Arduino.h>
+
+// Longest command line accepted
+#ifndef TC_LINELEN
+#define TC_LINELEN 64
+#endif
+
+// TelnetCommand: command interpreter for the input of a telnet session, shared by both TelnetLog variants.
+// Each session has one. Input is collected up to the end of a line, telnet negotiations are skipped.
+// The commands changing the logging are done here, pause and resume only set the session's state.
+// Commands needing the server's data are returned by execute() for the server to carry out.
+//   help                    list the commands
+//   level [<level>]         show or set MBUlogLvl. Levels are 0..6 or none, critical, ..., verbose
+//   module <name> [<level>] show or set the level of a module, "off" to remove it
+//   pause, resume           stop or restart the log output to this session
+//   history [<bytes>]       replay the log history                      (returned: TC_HISTORY)
+//   stats                   show the output statistics                  (returned: TC_STATS)
+class TelnetCommand {
+public:
+  enum Action : uint8_t { TC_NONE = 0, TC_HISTORY, TC_STATS };
+
+  TelnetCommand();
+
+  // feed: collect input up to the end of a line. Returns the number of bytes used. 
+  // If ready() is true afterwards, the line has to be execute()d before more input is fed.
+  size_t feed(const uint8_t *data, size_t len);
+
+  // ready: true if a complete line is waiting
+  inline bool ready() const { return TC_ready; }
+
+  // execute: carry out the command line, writing the reply to out. Returns what the server has to do,
+  // with the numeric argument in arg (0 if none was given).
+  Action execute(Print &out, uint32_t &arg);
+
+  // paused: true if the session does not want log output
+  inline bool paused() const { return TC_paused; }
+
+protected:
+  char TC_line[TC_LINELEN];        // Line collected so far
+  uint8_t TC_len;                  // Number of chars in TC_line
+  uint8_t TC_skip;                 // Telnet negotiation bytes still to be skipped
+  bool TC_ready;                   // TC_line is complete
+  bool TC_overflow;                // Line was too long
+  bool TC_paused;                  // Log output paused
+};
+#endif
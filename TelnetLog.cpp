@@ -3,17 +3,30 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "TelnetLog.h"
+#include "Instrument.h"
 
 TelnetLog::TelnetLog(uint16_t p, uint8_t mc) {
   TL_maxClients = mc;
   TL_ConnectionEstablished = false;
+  telnetActive = false;
+  TL_staged = 0;
+  TL_dropped = 0;
   TL_Server = new WiFiServer(p);
   TL_Client = new WiFiClient[mc];
+  TL_cmd = new TelnetCommand[mc];
+  TL_history = nullptr;
+  TL_historyTail = LH_TAIL;
 }
 
 TelnetLog::~TelnetLog() {
   delete TL_Server;
   delete[] TL_Client;
+  delete[] TL_cmd;
+}
+
+void TelnetLog::setHistory(LogHistory *history, size_t tail) {
+  TL_history = history;
+  TL_historyTail = tail;
 }
 
 void TelnetLog::begin(const char * label) {
@@ -35,33 +48,82 @@ void TelnetLog::end() {
   TL_Server->stop();
 }
 
+// write: collect a single character. Output is sent line by line
 size_t TelnetLog::write(uint8_t c) {
-    size_t len = 0;
-  // Loop over clients
-  for (uint8_t i = 0; i < TL_maxClients; ++i) {
-    // Is it active?
-    if (TL_Client[i] || TL_Client[i].connected()) {
-      // Yes. print out line
-      len = TL_Client[i].write(c);
-    }
+  TL_stage[TL_staged++] = c;
+  if (c == '\n' || TL_staged == TL_STAGE_SIZE) flush();
+  return 1;
+}
+
+// write: collect a buffer to be sent. Larger buffers are sent in pieces of TL_STAGE_SIZE,
+// as clientSpace() can vouch for no more than that.
+size_t TelnetLog::write(const uint8_t *buffer, size_t len) {
+  PROF_SCOPE("TelnetLog::write");
+  const uint8_t *cp = buffer;
+  size_t left = len;
+  while (left) {
+    // Fill up the staging buffer as far as possible
+    size_t n = TL_STAGE_SIZE - TL_staged;
+    if (n > left) n = left;
+    memcpy(TL_stage + TL_staged, cp, n);
+    TL_staged += n;
+    cp += n;
+    left -= n;
+    // Staging buffer full? Then send it
+    if (TL_staged == TL_STAGE_SIZE) flush();
   }
+  // Complete line? Send it
+  if (len && buffer[len - 1] == '\n') flush();
   return len;
 }
 
-size_t TelnetLog::write(const uint8_t *buffer, size_t len) {
+// flush: send out the staging buffer
+void TelnetLog::flush() {
+  if (TL_staged) {
+    sendToClients(TL_stage, TL_staged);
+    TL_staged = 0;
+  }
+}
+
+// clientSpace: number of bytes a client will accept without blocking
+size_t TelnetLog::clientSpace(uint8_t i) {
+#if defined(ESP32)
+  // The ESP32 WiFiClient has no usable availableForWrite(), so we ask the socket if it is writable.
+  // lwIP reports a socket as writable only with more than TCP_SNDLOWAT bytes free, which is well above
+  // TL_STAGE_SIZE, the most sendToClients() will be given.
+  int fd = TL_Client[i].fd();
+  if (fd < 0) return 0;
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(fd, &set);
+  struct timeval tv = { 0, 0 };
+  return (select(fd + 1, NULL, &set, NULL, &tv) > 0) ? TL_STAGE_SIZE : 0;
+#else
+  return TL_Client[i].availableForWrite();
+#endif
+}
+
+// sendToClients: write data to all clients able to take it without blocking
+void TelnetLog::sendToClients(const uint8_t *buffer, size_t len) {
   // Loop over clients
   for (uint8_t i = 0; i < TL_maxClients; ++i) {
-    // Is it active?
-    if (TL_Client[i] || TL_Client[i].connected()) {
-      // Yes. print out line
-      len = TL_Client[i].write(buffer, len);
-      TL_Client[i].flush();
+    // Is it active and wants output?
+    if ((TL_Client[i] || TL_Client[i].connected()) && !TL_cmd[i].paused()) {
+      // Yes. Room enough to take it?
+      if (clientSpace(i) >= len) {
+        // Yes. print out line
+        TL_Client[i].write(buffer, len);
+      } else {
+        // No. The client will miss it
+        TL_dropped += len;
+      }
     }
   }
-  return len;
 }
 
 void TelnetLog::update() {
+  // Send out incomplete lines as well
+  flush();
   telnetActive = false;
   // Cleanup disconnected session
   for (uint8_t i = 0; i < TL_maxClients; i++) {
@@ -72,8 +134,8 @@ void TelnetLog::update() {
         // No, stop it.
         TL_Client[i].stop();
       } else {
-        // Yes. Discard any input!
-        while (TL_Client[i].available()) TL_Client[i].read();
+        // Yes. Look for commands
+        handleInput(i);
         telnetActive = true;
       }
     }
@@ -103,7 +165,11 @@ void TelnetLog::update() {
         TL_Client[i].println(WiFi.localIP());
   
         TL_Client[i].println("----------------------------------------------------------------");
-        
+
+        // Show what happened before
+        if (TL_history) TL_history->replay(TL_Client[i], TL_historyTail);
+
+        TL_cmd[i] = TelnetCommand();
         TL_ConnectionEstablished = true; 
         
         break;
@@ -115,3 +181,36 @@ void TelnetLog::update() {
     }
   }
 }
+
+// handleInput: feed the client's input to its command interpreter. Replies go to the client directly.
+void TelnetLog::handleInput(uint8_t i) {
+  uint8_t buffer[32];
+  while (TL_Client[i].available() > 0) {
+    int got = TL_Client[i].read(buffer, sizeof(buffer));
+    if (got <= 0) break;
+    const uint8_t *input = buffer;
+    size_t len = got;
+    while (len) {
+      size_t used = TL_cmd[i].feed(input, len);
+      input += used;
+      len -= used;
+      // Complete command line?
+      if (TL_cmd[i].ready()) {
+        // Yes. Execute it and do what is left to us
+        uint32_t arg = 0;
+        switch (TL_cmd[i].execute(TL_Client[i], arg)) {
+        case TelnetCommand::TC_HISTORY:
+          if (TL_history) TL_history->replay(TL_Client[i], arg ? arg : TL_historyTail);
+          else            TL_Client[i].print("No history\n");
+          break;
+        case TelnetCommand::TC_STATS:
+          TL_Client[i].printf("%u bytes dropped for slow clients\n", (unsigned int)TL_dropped);
+          PROF_DUMP(TL_Client[i]);
+          break;
+        default:
+          break;
+        }
+      }
+    }
+  }
+}
@@ -11,7 +11,24 @@
 #include <WiFi.h>
 #endif
 #include <WiFiUdp.h>
+#include "LogHistory.h"
+#include "TelnetCommand.h"
+#include "Tick.h"
 
+// Size of the staging buffer collecting output before it is sent
+#ifndef TL_STAGE_SIZE
+#define TL_STAGE_SIZE 128
+#endif
+
+// Interval in ms nextDue() is asking for update() calls to accept new clients
+#ifndef TL_POLLTIME
+#define TL_POLLTIME 100
+#endif
+
+// TelnetLog will never block on a slow client. Output is collected in a staging buffer
+// and sent when a line is complete, the buffer is full or update() is called.
+// A client not able to take the data without blocking will miss it.
+// Client input is taken as commands, see TelnetCommand.h, and is processed in update().
 class TelnetLog : public Print {
 public:
   TelnetLog(uint16_t port, uint8_t maxClients);
@@ -22,6 +39,14 @@ public:
   inline bool isActive() { return telnetActive; };
   size_t write(uint8_t c);
   size_t write(const uint8_t *buffer, size_t size);
+  // flush: send staged output now
+  void flush();
+  // getDropped: number of bytes clients have missed because they could not take them
+  inline uint32_t getDropped() { return TL_dropped; }
+  // nextDue: time update() should be called next - at once if output is waiting
+  inline uint32_t nextDue() { return Tick::now() + (TL_staged ? 0 : TL_POLLTIME); }
+  // setHistory: replay the last tail bytes of history to each new client. nullptr will stop it.
+  void setHistory(LogHistory *history, size_t tail = LH_TAIL);
 
 protected:
     // Telnet definitions
@@ -31,5 +56,14 @@ protected:
     WiFiClient *TL_Client;
     bool telnetActive;
     char myLabel[64];
+    uint8_t TL_stage[TL_STAGE_SIZE];  // Staging buffer
+    size_t TL_staged;                 // Number of bytes in TL_stage
+    uint32_t TL_dropped;              // Number of bytes dropped for slow clients
+    TelnetCommand *TL_cmd;            // Command interpreters, one per client slot
+    LogHistory *TL_history;           // History to be replayed to new clients
+    size_t TL_historyTail;            // Number of history bytes to replay
+    void sendToClients(const uint8_t *buffer, size_t len);
+    void handleInput(uint8_t i);
+    size_t clientSpace(uint8_t i);
 };
 
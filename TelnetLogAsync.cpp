@@ -3,22 +3,41 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "TelnetLogAsync.h"
+#include "Instrument.h"
 
 TelnetLog::TelnetLog(uint16_t p, uint8_t mc, size_t rbSize) {
   TL_maxClients = mc;
   TL_Server = new AsyncServer(p);
   myRBsize = rbSize;
-  TL_Client.clear();
+  TL_buffer = new LogBuffer(rbSize);
+  TL_seq = 0;
+  TL_flushSize = TL_FLUSH_SIZE;
+  TL_flushLatency = TL_FLUSH_LATENCY;
+  TL_pending = 0;
+  TL_stats = Stats();
+  TL_dropMarker = true;
+  TL_history = nullptr;
+  TL_historyTail = LH_TAIL;
+  // All client slots are allocated here, connecting clients will not need any more heap
+  TL_pool = new ClientList[mc];
+  for (uint8_t i = 0; i < mc; ++i) {
+    TL_pool[i].server = this;
+  }
+  TL_active = 0;
   TL_Server->onClient(&handleNewClient, (void *)this);
 }
 
 TelnetLog::~TelnetLog() {
+  TL_ticker.detach();
   delete TL_Server;
-  for (auto it : TL_Client) {
-    delete it;
+  {
+    LOCK_GUARD(sLock, TL_sendLock);
+    for (uint8_t i = 0; i < TL_maxClients; ++i) {
+      if (TL_pool[i].client) release(this, &TL_pool[i], true);
+    }
   }
-  TL_Client.clear();
-  std::vector<ClientList *>().swap(TL_Client);
+  delete[] TL_pool;
+  delete TL_buffer;
 }
 
 void TelnetLog::begin(const char * label) {
@@ -28,124 +47,346 @@ void TelnetLog::begin(const char * label) {
 }
 
 void TelnetLog::end() {
+  TL_ticker.detach();
   TL_Server->end();
-  for (auto it : TL_Client) {
-    delete it;
+  LOCK_GUARD(sLock, TL_sendLock);
+  for (uint8_t i = 0; i < TL_maxClients; ++i) {
+    if (TL_pool[i].client) release(this, &TL_pool[i], true);
   }
-  TL_Client.clear();
 }
 
-size_t TelnetLog::write(uint8_t c) {
-  // Loop over clients
-  for (auto cl : TL_Client) {
-    if (cl->client->connected()) { // } && client->canSend()) {
-      cl->buffer->push_back(c);
+void TelnetLog::setFlush(size_t threshold, uint32_t maxLatency) {
+  TL_flushSize = threshold;
+  TL_flushLatency = maxLatency;
+}
+
+// flush: send out all pending output right away
+void TelnetLog::flush() {
+  TL_ticker.detach();
+  sendAll(this);
+}
+
+void TelnetLog::setHistory(LogHistory *history, size_t tail) {
+  LOCK_GUARD(sLock, TL_sendLock);
+  TL_history = history;
+  TL_historyTail = tail;
+}
+
+// getStats: get the statistics for client number client, or the aggregated ones for client == -1
+bool TelnetLog::getStats(Stats &stats, int client) {
+  LOCK_GUARD(sLock, TL_sendLock);
+  LOCK_GUARD(cLock, TL_lock);
+  if (client < 0) {
+    stats = TL_stats;
+    return true;
+  }
+  // Find the client-th slot in use
+  for (uint8_t i = 0; i < TL_maxClients; ++i) {
+    ClientList *cl = &TL_pool[i];
+    if (cl->client && client-- == 0) {
+      stats = cl->stats;
+      stats.queued = TL_seq - cl->start;
+      return true;
     }
   }
-  return 1;
+  return false;
 }
 
+// resetStats: start over with all statistics
+void TelnetLog::resetStats() {
+  LOCK_GUARD(sLock, TL_sendLock);
+  LOCK_GUARD(cLock, TL_lock);
+  TL_stats = Stats();
+  for (uint8_t i = 0; i < TL_maxClients; ++i) {
+    TL_pool[i].stats = Stats();
+    TL_pool[i].start = TL_seq;
+  }
+}
+
+// sendAll: give all clients their pending data
+void TelnetLog::sendAll(TelnetLog *s) {
+  LOCK_GUARD(sLock, s->TL_sendLock);
+  sendPending(s);
+}
+
+// sendPending: the same as sendAll(), but TL_sendLock must be held by the caller!
+void TelnetLog::sendPending(TelnetLog *s) {
+  {
+    LOCK_GUARD(cLock, s->TL_lock);
+    s->TL_pending = 0;
+  }
+  for (uint8_t i = 0; i < s->TL_maxClients; ++i) {
+    if (s->TL_pool[i].client) sendBytes(s, &s->TL_pool[i]);
+  }
+}
+
+size_t TelnetLog::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+// write: add output to the shared buffer. The clients will pick it up from there.
 size_t TelnetLog::write(const uint8_t *buffer, size_t len) {
-  // Loop over clients
-  for (auto cl : TL_Client) {
-    if (cl->client->connected()) { // } && client->canSend()) {
-      cl->buffer->push_back(buffer, len);
-    }
+  PROF_SCOPE("TelnetLogAsync::write");
+  // Nobody listening?
+  if (!TL_active) return len;
+  bool flushNow = false;
+  {
+    LOCK_GUARD(cLock, TL_lock);
+    // Older data will be dropped if the buffer is full. Clients still needing it will notice
+    TL_buffer->push_back(buffer, len);
+    TL_seq += len;
+    TL_pending += len;
+    TL_stats.queued += len;
+    flushNow = (TL_pending >= TL_flushSize);
+  }
+  // Enough data collected to send a segment, and no client callback sending right now?
+  if (flushNow && TL_sendLock.try_lock()) {
+    // Yes. Send it right away
+    TL_ticker.detach();
+    sendPending(this);
+    TL_sendLock.unlock();
+  } else if ((flushNow || TL_flushLatency) && !TL_ticker.active()) {
+    // No. Make sure it will be sent in time. We will not wait for a callback to finish.
+    TL_ticker.once_ms(flushNow ? 1 : TL_flushLatency, &sendAll, this);
   }
   return len;
 }
 
+// ClientPrint: Print adding output directly to the send buffer of an AsyncClient, as far as it fits
+struct ClientPrint : public Print {
+  AsyncClient *client;
+  explicit ClientPrint(AsyncClient *c) : client(c) {}
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buffer, size_t len) {
+    if (len > client->space()) len = client->space();
+    return len ? client->add((const char *)buffer, len, ASYNC_WRITE_FLAG_COPY) : 0;
+  }
+};
+
 void TelnetLog::handleNewClient(void *srv, AsyncClient* newClient) {
   char buffer[80];
   TelnetLog *s = reinterpret_cast<TelnetLog *>(srv);
 
-  // Space left?
-  if (s->TL_Client.size() < s->TL_maxClients) {
-    // add to list
-    ClientList *c = new ClientList(s->myRBsize, newClient);
-    s->TL_Client.push_back(c);
-	
-    // register events
-    newClient->onData(&handleData, srv);
-    newClient->onPoll(&handlePoll, srv);
-    newClient->onAck(&handleAck, srv);
-    newClient->onDisconnect(&handleDisconnect, srv);
-
-    snprintf(buffer, 80, "Welcome to '%s'!\n", s->myLabel);
-    newClient->add(buffer, strlen(buffer));
-        
-    snprintf(buffer, 80, "Millis since start: %ul\n", (uint32_t)millis());
-    newClient->add(buffer, strlen(buffer));
-        
-    snprintf(buffer, 80, "Free heap RAM: %d\n", ESP.getFreeHeap());
-    newClient->add(buffer, strlen(buffer));
-
-    snprintf(buffer, 80, "Server IP: %d.%d.%d.%d\n", WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
-    newClient->add(buffer, strlen(buffer));
-
-    memset(buffer, '-', 80);
-    buffer[78] = '\n';
-    buffer[79] = 0;
-    newClient->add(buffer, strlen(buffer));
-
-    newClient->send();
-  } else {
+  // Nothing may be sent to the client before the greeting and history are queued
+  LOCK_GUARD(sLock, s->TL_sendLock);
+
+  // Free slot left?
+  ClientList *cl = nullptr;
+  for (uint8_t i = 0; i < s->TL_maxClients; ++i) {
+    if (!s->TL_pool[i].client) {
+      cl = &s->TL_pool[i];
+      break;
+    }
+  }
+  if (!cl) {
     // No, maximum number of clients reached
     newClient->close(true);
     newClient->stop();
     delete newClient;
+    return;
+  }
+
+  // register events. The slot is passed to the callbacks
+  newClient->onData(&handleData, cl);
+  newClient->onPoll(&handlePoll, cl);
+  newClient->onAck(&handleAck, cl);
+  newClient->onDisconnect(&handleDisconnect, cl);
+
+  snprintf(buffer, 80, "Welcome to '%s'!\n", s->myLabel);
+  newClient->add(buffer, strlen(buffer), ASYNC_WRITE_FLAG_COPY);
+      
+  snprintf(buffer, 80, "Millis since start: %ul\n", (uint32_t)millis());
+  newClient->add(buffer, strlen(buffer), ASYNC_WRITE_FLAG_COPY);
+      
+  snprintf(buffer, 80, "Free heap RAM: %d\n", ESP.getFreeHeap());
+  newClient->add(buffer, strlen(buffer), ASYNC_WRITE_FLAG_COPY);
+
+  snprintf(buffer, 80, "Server IP: %d.%d.%d.%d\n", WiFi.localIP()[0], WiFi.localIP()[1], WiFi.localIP()[2], WiFi.localIP()[3]);
+  newClient->add(buffer, strlen(buffer), ASYNC_WRITE_FLAG_COPY);
+
+  memset(buffer, '-', 80);
+  buffer[78] = '\n';
+  buffer[79] = 0;
+  newClient->add(buffer, strlen(buffer), ASYNC_WRITE_FLAG_COPY);
+
+  // Show what happened before
+  if (s->TL_history) {
+    ClientPrint cp(newClient);
+    s->TL_history->replay(cp, s->TL_historyTail);
+  }
+
+  // Take the slot. The client will get all output from now on
+  {
+    LOCK_GUARD(cLock, s->TL_lock);
+    cl->take(newClient, s->TL_seq);
   }
+  s->TL_active++;
+
+  newClient->send();
 }
 
-void TelnetLog::handleDisconnect(void *srv, AsyncClient *c) {
-  TelnetLog *s = reinterpret_cast<TelnetLog *>(srv);
-  for (auto it = s->TL_Client.begin(); it != s->TL_Client.end();) {
-    if ((*it)->client == c) {
-      delete (*it);
-      s->TL_Client.erase(it);
-      it = s->TL_Client.end();
-    } else {
-      it++;
+// release: free a slot and delete its client. TL_sendLock must be held by the caller!
+// The disconnect callback is detached first, as closing will fire it.
+void TelnetLog::release(TelnetLog *s, ClientList *cl, bool close) {
+  AsyncClient *client = cl->client;
+  cl->client = nullptr;
+  s->TL_active--;
+  if (close) {
+    client->onDisconnect(nullptr, nullptr);
+    client->close(true);
+    client->stop();
+  }
+  delete client;
+}
+
+void TelnetLog::handleDisconnect(void *slot, AsyncClient *c) {
+  ClientList *cl = reinterpret_cast<ClientList *>(slot);
+  LOCK_GUARD(sLock, cl->server->TL_sendLock);
+  if (cl->client == c) release(cl->server, cl, false);
+}
+
+// handleData: the client's input is taken as commands. Replies go to the client directly.
+void TelnetLog::handleData(void *slot, AsyncClient* client, void *data, size_t len) {
+  ClientList *cl = reinterpret_cast<ClientList *>(slot);
+  TelnetLog *s = cl->server;
+  LOCK_GUARD(sLock, s->TL_sendLock);
+  if (cl->client != client) return;
+  ClientPrint cp(client);
+  const uint8_t *input = static_cast<const uint8_t *>(data);
+  while (len) {
+    size_t used = cl->cmd.feed(input, len);
+    input += used;
+    len -= used;
+    // Complete command line?
+    if (cl->cmd.ready()) {
+      // Yes. Execute it and do what is left to us
+      uint32_t arg = 0;
+      switch (cl->cmd.execute(cp, arg)) {
+      case TelnetCommand::TC_HISTORY:
+        if (s->TL_history) s->TL_history->replay(cp, arg ? arg : s->TL_historyTail);
+        else               cp.print("No history\n");
+        break;
+      case TelnetCommand::TC_STATS:
+        printStats(s, cl, cp);
+        break;
+      default:
+        break;
+      }
     }
   }
+  client->send();
 }
 
-void TelnetLog::handleData(void *srv, AsyncClient* client, void *data, size_t len) {
-  // Do nothing for now, ignore data
+// printStats: the client's and the aggregated statistics. TL_sendLock must be held by the caller!
+void TelnetLog::printStats(TelnetLog *s, ClientList *cl, Print &out) {
+  uint32_t seq;
+  uint32_t queued;
+  {
+    LOCK_GUARD(cLock, s->TL_lock);
+    seq = s->TL_seq;
+    queued = s->TL_stats.queued;
+  }
+  out.printf("Session: %u queued, %u sent, %u dropped, max. backlog %u, latency %ums\n",
+    (unsigned int)(seq - cl->start), (unsigned int)cl->stats.sent, (unsigned int)cl->stats.dropped,
+    (unsigned int)cl->stats.maxFill, (unsigned int)cl->stats.latency);
+  out.printf("All:     %u queued, %u sent, %u dropped, max. backlog %u, %u clients\n",
+    (unsigned int)queued, (unsigned int)s->TL_stats.sent, (unsigned int)s->TL_stats.dropped,
+    (unsigned int)s->TL_stats.maxFill, (unsigned int)s->TL_active);
+  PROF_DUMP(out);
 }
 
-void TelnetLog::sendBytes(TelnetLog *s, AsyncClient *client) {
+// stage: copy up to maxLen bytes from the client's cursor on into TL_stage. TL_lock is held
+// for the copy only. Returns the number of bytes staged, or 0 if the client has to be told 
+// about missed data first. TL_sendLock must be held by the caller!
+size_t TelnetLog::stage(TelnetLog *s, ClientList *cl, size_t maxLen) {
+  LOCK_GUARD(cLock, s->TL_lock);
+  // Sequence number of the oldest byte still in the buffer
+  uint32_t oldest = s->TL_seq - s->TL_buffer->size();
+  // Has the client fallen behind?
+  if ((int32_t)(oldest - cl->cursor) > 0) {
+    // Yes. Skip what is gone already
+    uint32_t lost = oldest - cl->cursor;
+    cl->stats.dropped += lost;
+    s->TL_stats.dropped += lost;
+    if (s->TL_dropMarker) cl->dropped += lost;
+    cl->cursor = oldest;
+  }
+  if (cl->dropped) return 0;
+  // Keep track of the backlog
+  uint32_t fill = s->TL_seq - cl->cursor;
+  if (fill > cl->stats.maxFill) cl->stats.maxFill = fill;
+  if (fill > s->TL_stats.maxFill) s->TL_stats.maxFill = fill;
+  // Copy up to two contiguous parts of the buffer, if it wraps around
+  if (maxLen > TL_SEND_CHUNK) maxLen = TL_SEND_CHUNK;
+  size_t staged = 0;
+  while (staged < maxLen) {
+    size_t len = 0;
+    const uint8_t *data = s->TL_buffer->peekContiguous(len, cl->cursor - oldest + staged);
+    if (!len) break;
+    if (len > maxLen - staged) len = maxLen - staged;
+    memcpy(s->TL_stage + staged, data, len);
+    staged += len;
+  }
+  return staged;
+}
+
+// sendBytes: hand over the shared buffer's data from the client's cursor on to lwIP.
+// The data is copied chunk by chunk into TL_stage first, so lwIP is called without TL_lock 
+// and write() may overwrite the shared buffer meanwhile. TL_sendLock must be held by the caller!
+void TelnetLog::sendBytes(TelnetLog *s, ClientList *cl) {
+  AsyncClient *client = cl->client;
+  // Output paused? Then the client skips everything up to here
+  if (cl->cmd.paused()) {
+    LOCK_GUARD(cLock, s->TL_lock);
+    cl->cursor = s->TL_seq;
+    cl->dropped = 0;
+    return;
+  }
   if (client->connected()) {
+    size_t sent = 0;
     size_t numBytes = client->space();
-    if (numBytes) {
-      for (auto it : s->TL_Client) {
-        if (it->client == client) {
-          size_t numSend = it->buffer->size();
-          if (numSend && client->canSend()) {
-            if (numSend <= numBytes) {
-              client->write((const char *)it->buffer->data(), numSend, ASYNC_WRITE_FLAG_COPY);
-              it->buffer->pop(numSend);
-            } else {
-              client->write((const char *)it->buffer->data(), numBytes, ASYNC_WRITE_FLAG_COPY);
-              it->buffer->pop(numBytes);
-            }
-            break;
-          }
-          break;
-        }
+    while (numBytes && client->canSend()) {
+      // Do we have to tell the client about missed data?
+      if (cl->dropped) {
+        // Yes. Put out a marker line
+        char marker[40];
+        int len = snprintf(marker, sizeof(marker), "\n[%u bytes dropped]\n", (unsigned int)cl->dropped);
+        if (len <= 0 || (size_t)len > numBytes) break;
+        len = client->add(marker, len, ASYNC_WRITE_FLAG_COPY);
+        if (!len) break;
+        cl->dropped = 0;
+        numBytes -= len;
+        sent += len;
       }
+      size_t len = stage(s, cl, numBytes);
+      // Data lost while we were sending? Then the marker goes first
+      if (cl->dropped) continue;
+      if (!len) break;
+      len = client->add((const char *)s->TL_stage, len, ASYNC_WRITE_FLAG_COPY);
+      if (!len) break;
+      cl->cursor += len;
+      cl->stats.sent += len;
+      s->TL_stats.sent += len;
+      numBytes -= len;
+      sent += len;
     }
+    if (sent) client->send();
   }
-
 }
 
-void TelnetLog::handlePoll(void *srv, AsyncClient *client) {
-  TelnetLog *s = reinterpret_cast<TelnetLog *>(srv);
-  sendBytes(s, client);
+void TelnetLog::handlePoll(void *slot, AsyncClient *client) {
+  ClientList *cl = reinterpret_cast<ClientList *>(slot);
+  LOCK_GUARD(sLock, cl->server->TL_sendLock);
+  if (cl->client == client) sendBytes(cl->server, cl);
 }
 
-void TelnetLog::handleAck(void *srv, AsyncClient *client, size_t len, uint32_t aTime) {
-  TelnetLog *s = reinterpret_cast<TelnetLog *>(srv);
-  sendBytes(s, client);
+void TelnetLog::handleAck(void *slot, AsyncClient *client, size_t len, uint32_t aTime) {
+  ClientList *cl = reinterpret_cast<ClientList *>(slot);
+  TelnetLog *s = cl->server;
+  LOCK_GUARD(sLock, s->TL_sendLock);
+  if (cl->client != client) return;
+  cl->stats.latency = aTime;
+  s->TL_stats.latency = aTime;
+  sendBytes(s, cl);
 }
 
@@ -8,7 +8,10 @@
 // Include Arduino.h to make Print and Serial known
 #include <Arduino.h>
 #include <vector>
+#include <Ticker.h>
 #include "RingBuf.h"
+#include "LogHistory.h"
+#include "TelnetCommand.h"
 
 #ifdef ESP8266
 #include <ESP8266WiFi.h>
@@ -25,45 +28,125 @@
 
 using std::vector;
 
+// Default flush policy: send as soon as a full TCP segment is collected, 
+// but do not hold back output longer than TL_FLUSH_LATENCY milliseconds
+#ifdef TCP_MSS
+#define TL_FLUSH_SIZE TCP_MSS
+#else
+#define TL_FLUSH_SIZE 536
+#endif
+#define TL_FLUSH_LATENCY 20
+
+// Number of bytes copied out of the shared buffer in one go to be handed over to TCP
+#ifndef TL_SEND_CHUNK
+#define TL_SEND_CHUNK TL_FLUSH_SIZE
+#endif
+
 class TelnetLog : public Print {
 public:
+  // Statistics, kept for each client and summed up for the server
+  struct Stats {
+    uint32_t queued;       // Number of bytes written for the client(s)
+    uint32_t sent;         // Number of bytes handed over to TCP
+    uint32_t dropped;      // Number of bytes lost because the client(s) could not keep up
+    uint32_t maxFill;      // Highest number of bytes waiting in the buffer to be sent
+    uint32_t latency;      // Time in ms between sending and acknowledgement of the last data
+  };
+
   TelnetLog(uint16_t port, uint8_t maxClients, size_t rbSize = 256);
   ~TelnetLog();
   void begin(const char *label);
   void end();
-  inline bool isActive() { return (TL_Client.size() ? true : false); };
+  inline bool isActive() { return TL_active > 0; };
   size_t write(uint8_t c);
   size_t write(const uint8_t *buffer, size_t size);
-  inline unsigned int getActiveClients() { return TL_Client.size(); }
+  inline unsigned int getActiveClients() { return TL_active; }
+
+  // setFlush: set the flush policy. Output is sent to the clients as soon as threshold bytes 
+  // have been collected, or maxLatency milliseconds after the first byte not yet sent.
+  // threshold = 0 will send on every write, maxLatency = 0 will not start a timer.
+  void setFlush(size_t threshold, uint32_t maxLatency);
+
+  // flush: send all pending output now
+  void flush();
+
+  // getStats: get the statistics for a client (0..getActiveClients()-1) or the aggregate for 
+  // all clients since start or the last resetStats() (client = -1). Returns false if there is no such client.
+  bool getStats(Stats &stats, int client = -1);
+
+  // resetStats: zero all statistics
+  void resetStats();
+
+  // setDropMarker: if on (default), clients will get a "[N bytes dropped]" line where data was lost
+  inline void setDropMarker(bool on) { TL_dropMarker = on; }
+
+  // setHistory: replay the last tail bytes of history to each new client. nullptr will stop it.
+  void setHistory(LogHistory *history, size_t tail = LH_TAIL);
 
 protected:
+    // All output is kept in a single buffer shared by all clients. Each client only has its own
+    // read position in it. The buffer is protected by TL_lock, as the buffer contents and TL_seq 
+    // have to be consistent. The sending side holds TL_lock only to copy a chunk into TL_stage,
+    // never while calling into TCP, so write() will not wait for the clients.
+    typedef RingBuf<uint8_t, RB_NOLOCK> LogBuffer;
+    // The clients are kept in a pool of TL_maxClients slots, allocated once by the constructor.
+    // A slot is the argument of its AsyncClient's callbacks, so these find it without searching.
     struct ClientList {
-      AsyncClient *client;
-      RingBuf<uint8_t> *buffer;
-      ClientList(size_t bufSize, AsyncClient *c) {
-        buffer = new RingBuf<uint8_t>(bufSize);
+      TelnetLog *server;         // Server the slot belongs to
+      AsyncClient *client;       // Client using the slot, nullptr if free
+      uint32_t cursor;           // Sequence number of the next byte to be sent to this client
+      uint32_t dropped;          // Number of bytes this client has missed, not reported yet
+      uint32_t start;            // Sequence number the statistics were started at
+      Stats stats;               // Statistics for this client
+      TelnetCommand cmd;         // Interpreter for the client's input
+      ClientList() :
+        server(nullptr),
+        client(nullptr),
+        cursor(0),
+        dropped(0),
+        start(0),
+        stats() {}
+      // take: occupy the slot for a new client, starting at sequence number st
+      void take(AsyncClient *c, uint32_t st) {
         client = c;
-      }
-      ~ClientList() {
-        if (client) {
-          client->close(true);
-          client->stop();
-          delete client;
-        }
-        if (buffer) delete buffer;
+        cursor = st;
+        dropped = 0;
+        start = st;
+        stats = Stats();
+        cmd = TelnetCommand();
       }
     };
     // Telnet definitions
     uint8_t TL_maxClients;                     // max. number of concurrent clients allowed
     AsyncServer *TL_Server;                    // Hook for the AsyncServerTCP
-    std::vector<ClientList *> TL_Client;       // List of clients connected
+    ClientList *TL_pool;                       // Slots for the clients
+    std::atomic<uint8_t> TL_active;            // Number of slots in use
     char myLabel[64];                          // Welcome label to be shown to new clients
-    size_t myRBsize;                           // Size of client'S circular buffer
+    size_t myRBsize;                           // Size of the shared circular buffer
+    LogBuffer *TL_buffer;                      // Output buffer shared by all clients
+    uint32_t TL_seq;                           // Sequence number of the next byte written (=total bytes written)
+    RB_Lock TL_lock;                           // Protects TL_buffer, TL_seq, TL_pending and TL_stats.queued
+    RB_Lock TL_sendLock;                       // Serializes the sending side: TL_pool, TL_stage and the clients
+    uint8_t TL_stage[TL_SEND_CHUNK];           // Chunk of TL_buffer on its way to a client
+    size_t TL_flushSize;                       // Number of pending bytes to trigger a send
+    uint32_t TL_flushLatency;                  // Max. time in ms output may remain pending
+    size_t TL_pending;                         // Number of bytes written since last flush
+    Ticker TL_ticker;                          // Timer to enforce TL_flushLatency
+    Stats TL_stats;                            // Aggregated statistics
+    bool TL_dropMarker;                        // Send an in-band marker for dropped data
+    LogHistory *TL_history;                    // History to be replayed to new clients
+    size_t TL_historyTail;                     // Number of history bytes to replay
     static void handleNewClient(void *srv, AsyncClient *client);
-    static void handleDisconnect(void *srv, AsyncClient *client);
-    static void handlePoll(void *srv, AsyncClient *client);
-    static void handleAck(void *srv, AsyncClient *client, size_t len, uint32_t aTime);
-    static void handleData(void *srv, AsyncClient* client, void *data, size_t len);
-    static void sendBytes(TelnetLog *server, AsyncClient *client);
+    // The client callbacks get the client's slot as first argument
+    static void handleDisconnect(void *slot, AsyncClient *client);
+    static void handlePoll(void *slot, AsyncClient *client);
+    static void handleAck(void *slot, AsyncClient *client, size_t len, uint32_t aTime);
+    static void handleData(void *slot, AsyncClient* client, void *data, size_t len);
+    static void sendBytes(TelnetLog *server, ClientList *cl);
+    static void sendAll(TelnetLog *server);
+    static void sendPending(TelnetLog *server);
+    static size_t stage(TelnetLog *server, ClientList *cl, size_t maxLen);
+    static void release(TelnetLog *server, ClientList *cl, bool close);
+    static void printStats(TelnetLog *server, ClientList *cl, Print &out);
 };
 #endif
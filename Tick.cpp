@@ -0,0 +1,28 @@
+// Tick
+// Copyright 2020 by miq1@gmx.de
+
+#include "Tick.h"
+
+uint64_t Tick::TK_us = 0;
+uint64_t Tick::TK_ms = 0;
+bool Tick::TK_valid = false;
+
+void Tick::update() {
+#if defined(ESP32) || defined(ESP8266)
+  TK_us = us64();
+  TK_ms = TK_us / 1000;
+#else
+  uint32_t ms = millis();
+  uint32_t us = micros();
+  if (!TK_valid) {
+    // First call: micros() may have wrapped already, so take the microseconds within the millisecond only
+    TK_ms = ms;
+    TK_us = (uint64_t)ms * 1000 + (uint32_t)(us - ms * 1000u) % 1000;
+  } else {
+    // Add the time passed since the last update(), as far as the 32 bit timers can tell
+    TK_us += (uint32_t)(us - (uint32_t)TK_us);
+    TK_ms += (uint32_t)(ms - (uint32_t)TK_ms);
+  }
+#endif
+  TK_valid = true;
+}
@@ -0,0 +1,63 @@
+// Tick
+// Copyright 2020 by miq1@gmx.de
+//
+// Tick is a time base read once per loop pass. Tick::update() reads the timer and keeps the time,
+// the Blinkers, Buttoners, ButtonGroups and the Scheduler then take it from Tick::now() instead
+// of reading the timer again. All of them see the same time within a loop pass this way.
+// Scheduler::run() calls update() itself, without a Scheduler put it at the start of your loop().
+// Before the first update() the timer is read on each call, as millis() would do.
+//
+// The cached time is meant for the loop task only. Interrupt handlers and other tasks need to use
+// millis() or the uncached us64() and ms64().
+// On targets other than the ESP32 and ESP8266 only 32 bit timers are known. update() extends these 
+// to 64 bits by counting their wrap-arounds, so it has to be called at least every 71 minutes there.
+//
+#ifndef _TICK_H
+#define _TICK_H
+#include <Arduino.h>
+#if defined(ESP32)
+#include <esp_timer.h>
+#endif
+
+class Tick {
+public:
+  // update: read the timer and keep the time for this loop pass
+  static void update();
+
+  // now: milliseconds since start as of the last update(), wrapping around like millis()
+  static inline uint32_t now() { return TK_valid ? (uint32_t)TK_ms : millis(); }
+
+  // now64: the same in 64 bits, which will not wrap around in practice
+  static inline uint64_t now64() { return TK_valid ? TK_ms : ms64(); }
+
+  // nowUs: microseconds since start as of the last update(), 64 bits
+  static inline uint64_t nowUs() { return TK_valid ? TK_us : us64(); }
+
+  // us64: read the timer now, in microseconds
+  static inline uint64_t us64() {
+#if defined(ESP32)
+    return (uint64_t)esp_timer_get_time();
+#elif defined(ESP8266)
+    return micros64();
+#else
+    // No 64 bit timer known - extend micros() from the last update()
+    return TK_us + (uint32_t)(micros() - (uint32_t)TK_us);
+#endif
+  }
+
+  // ms64: read the timer now, in milliseconds
+  static inline uint64_t ms64() {
+#if defined(ESP32) || defined(ESP8266)
+    return us64() / 1000;
+#else
+    return TK_ms + (uint32_t)(millis() - (uint32_t)TK_ms);
+#endif
+  }
+
+protected:
+  static uint64_t TK_us;      // Time of the last update() in microseconds
+  static uint64_t TK_ms;      // Time of the last update() in milliseconds
+  static bool TK_valid;       // update() has been called
+};
+
+#endif
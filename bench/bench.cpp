@@ -0,0 +1,858 @@
+// Benchmarks for the hot paths of RingBuf, Logging and TelnetLogAsync
+// Copyright 2020 by miq1@gmx.de
+//
+// Regression checks run first: RingBuf against a std::deque model, RB_SPSC with two threads, the TelnetCommand parser
+// and - on the host - the Scheduler and Tick across the 32 bit millisecond wrap-around, and with
+// LOG_DEFERRED several threads storing deferred log records.
+// Any failed check makes the host binary exit with 1.
+// Then it reports ns/op and MB/s for each case. Built for the host against the shim in bench/host,
+// or for an ESP32 as a sketch, where the CPU cycle counter is used for timing.
+// See the "Benchmarks" section of README.md for the build commands.
+//
+#define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include <Arduino.h>
+#include "RingBuf.h"
+#include "Logging.h"
+#include "TelnetLogAsync.h"
+#include "TelnetCommand.h"
+#include <deque>
+#include <string>
+#include <vector>
+#if !defined(ARDUINO)
+#include "Scheduler.h"
+#include "Tick.h"
+#include <atomic>
+#include <thread>
+#endif
+
+#if defined(ARDUINO)
+// On the device: count CPU cycles
+typedef uint32_t BenchTicks;
+inline BenchTicks benchTicks() { return ESP.getCycleCount(); }
+inline double benchNs(BenchTicks t) { return t * 1000.0 / ESP.getCpuFreqMHz(); }
+// Keep the cycle counter from wrapping during a case
+#define BENCH_OPS 20000
+// Random operations per RingBuf check
+#define CHECK_OPS 5000
+#else
+#include <chrono>
+typedef uint64_t BenchTicks;
+inline BenchTicks benchTicks() {
+  using namespace std::chrono;
+  return (BenchTicks)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline double benchNs(BenchTicks t) { return (double)t; }
+#define BENCH_OPS 1000000
+#define CHECK_OPS 200000
+#endif
+
+// NullPrint: a Print swallowing everything, counting the bytes
+class NullPrint : public Print {
+public:
+  NullPrint() : count(0) {}
+  size_t write(uint8_t) { count++; return 1; }
+  size_t write(const uint8_t *, size_t size) { count += size; return size; }
+  using Print::write;
+  size_t count;
+};
+
+// Keep the compiler from optimizing away results
+volatile size_t benchSink;
+
+// bench: run f(ops) once to warm up, then time it. bytes is the payload of one op.
+template<typename F> void bench(Print &out, const char *name, uint32_t ops, size_t bytes, F f) {
+  f(ops / 10 + 1);
+  BenchTicks start = benchTicks();
+  f(ops);
+  double ns = benchNs(benchTicks() - start);
+  // bytes per ns are GB/s - times 1000 for MB/s
+  out.printf("%-36s %10.1f ns/op %10.1f MB/s\n", name, ns / ops, bytes ? bytes * (double)ops * 1000.0 / ns : 0.0);
+}
+
+const size_t BLOCK(64);
+uint8_t block[BLOCK];
+
+// benchRing: the RingBuf cases for one buffer type
+template<typename RB> void benchRing(Print &out, const char *mode, RB &rb) {
+  char name[48];
+  size_t cap = rb.capacity();
+
+  snprintf(name, sizeof(name), "%s push_back(1)", mode);
+  bench(out, name, BENCH_OPS, 1, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) {
+      if (!rb.push_back((uint8_t)i)) rb.clear();
+    }
+  });
+
+  snprintf(name, sizeof(name), "%s push_back(%u)", mode, (unsigned)BLOCK);
+  bench(out, name, BENCH_OPS / 10, BLOCK, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) {
+      if (!rb.push_back(block, BLOCK)) rb.clear();
+    }
+  });
+
+  snprintf(name, sizeof(name), "%s pop(1)", mode);
+  bench(out, name, BENCH_OPS, 1, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) {
+      if (!rb.pop(1)) {
+        while (rb.size() < cap) rb.push_back(block, BLOCK);
+      }
+    }
+  });
+
+  snprintf(name, sizeof(name), "%s safeCopy(%u, move)", mode, (unsigned)BLOCK);
+  bench(out, name, BENCH_OPS / 10, BLOCK, [&](uint32_t ops) {
+    uint8_t target[BLOCK];
+    for (uint32_t i = 0; i < ops; ++i) {
+      if (!rb.safeCopy(target, BLOCK, true)) {
+        while (rb.size() < cap) rb.push_back(block, BLOCK);
+      }
+    }
+    benchSink = target[0];
+  });
+
+  NullPrint null;
+  snprintf(name, sizeof(name), "%s drainTo(Print, %u)", mode, (unsigned)BLOCK);
+  bench(out, name, BENCH_OPS / 10, BLOCK, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) {
+      if (!rb.drainTo(null, BLOCK)) {
+        while (rb.size() < cap) rb.push_back(block, BLOCK);
+      }
+    }
+    benchSink = null.count;
+  });
+}
+
+// benchOverwrite: pushing into a full buffer dropping the oldest data
+template<typename RB> void benchOverwrite(Print &out, const char *mode, RB &rb) {
+  char name[48];
+  while (rb.size() < rb.capacity()) rb.push_back(block, BLOCK);
+
+  snprintf(name, sizeof(name), "%s full overwrite(1)", mode);
+  bench(out, name, BENCH_OPS, 1, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) rb.push_back((uint8_t)i);
+  });
+
+  snprintf(name, sizeof(name), "%s full overwrite(%u)", mode, (unsigned)BLOCK);
+  bench(out, name, BENCH_OPS / 10, BLOCK, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) rb.push_back(block, BLOCK);
+  });
+}
+
+#if !defined(ARDUINO)
+// BenchTelnet: give access to the server to have clients connect. Host only, as the clients
+// are the shim's, acknowledging everything at once.
+class BenchTelnet : public TelnetLog {
+public:
+  BenchTelnet(uint8_t maxClients, size_t rbSize) : TelnetLog(23, maxClients, rbSize) {}
+  inline AsyncServer *server() { return TL_Server; }
+};
+
+// benchFanout: lines written to TelnetLogAsync with clients acknowledging at once
+void benchFanout(Print &out, uint8_t clients) {
+  char name[48];
+  BenchTelnet tl(clients, 4096);
+  AsyncClient *client[8];
+  tl.begin("bench");
+  for (uint8_t i = 0; i < clients; ++i) {
+    client[i] = new AsyncClient;
+    tl.server()->connect(client[i]);
+  }
+  const char *line = "0123456789012345678901234567890123456789012345678901234567890\r\n";
+  size_t len = strlen(line);
+
+  snprintf(name, sizeof(name), "TelnetLogAsync fan-out %u client%s", clients, clients == 1 ? "" : "s");
+  bench(out, name, BENCH_OPS / 10, len * clients, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) {
+      tl.write((const uint8_t *)line, len);
+      for (uint8_t c = 0; c < clients; ++c) client[c]->ackAll();
+    }
+    tl.flush();
+  });
+  // All clients must have got everything
+  for (uint8_t c = 0; c < clients; ++c) {
+    if (client[c]->total() < (BENCH_OPS / 10 + BENCH_OPS / 100 + 1) * len) out.printf("  client %u lost data!\n", c);
+  }
+  tl.end();
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------
+// Regression checks. CHECK() counts a failure and reports the first few with their line number.
+Print *checkOut = &Serial;
+uint32_t checkFailed = 0;
+#define CHECK(cond) do { if (!(cond)) checkFail(__LINE__, #cond); } while (0)
+
+void checkFail(int line, const char *cond) {
+  if (checkFailed++ < 10) checkOut->printf("  line %d: %s failed\n", line, cond);
+}
+
+// checkDone: report the result of a check
+void checkDone(const char *name, uint32_t failedBefore) {
+  checkOut->printf("%-36s %s\n", name, (checkFailed == failedBefore) ? "ok" : "FAILED");
+}
+
+// Xorshift random numbers, the same sequence on host and device
+uint32_t checkSeed = 2463534242u;
+uint32_t checkRandom(uint32_t range) {
+  checkSeed ^= checkSeed << 13;
+  checkSeed ^= checkSeed >> 17;
+  checkSeed ^= checkSeed << 5;
+  return checkSeed % range;
+}
+
+// checkValue: a random element. Strings are long enough to be allocated on the heap.
+void checkValue(uint8_t &v) { v = checkRandom(256); }
+void checkValue(std::string &v) { v.assign(20 + checkRandom(20), 'a' + checkRandom(26)); }
+
+// checkEqual: is the buffer holding the elements of the model, in order?
+template<typename RB, typename T> bool checkEqual(RB &rb, std::deque<T> &m) {
+  if (rb.size() != m.size()) return false;
+  size_t i = 0;
+  for (const T &v : rb) {
+    if (i >= m.size() || !(v == m[i])) return false;
+    i++;
+  }
+  return i == m.size();
+}
+
+// checkDrain: drainTo() for byte buffers, nothing for others
+template<typename RB> void checkDrain(RB &rb, std::deque<uint8_t> &m) {
+  // A Print taking only part of the data
+  class Limited : public Print {
+  public:
+    explicit Limited(size_t limit) : room(limit) {}
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) {
+      if (size > room) size = room;
+      data.insert(data.end(), buffer, buffer + size);
+      room -= size;
+      return size;
+    }
+    size_t room;
+    std::vector<uint8_t> data;
+  } out(checkRandom(rb.capacity() + rb.size() + 2));
+  size_t n = rb.drainTo(out, checkRandom(m.size() + 2));
+  CHECK(n == out.data.size() && n <= m.size());
+  for (size_t i = 0; i < n && i < m.size(); ++i) CHECK(out.data[i] == m[i]);
+  m.erase(m.begin(), m.begin() + (n <= m.size() ? n : m.size()));
+}
+template<typename RB, typename T> void checkDrain(RB &, std::deque<T> &) {}
+
+// checkRotates: data() makes the used area contiguous, except in RB_SPSC mode
+template<typename T, RB_Mode MODE, size_t N, RB_Policy POLICY> bool checkRotates(const RingBuf<T, MODE, N, POLICY> &) {
+  return MODE != RB_SPSC;
+}
+
+// checkRing: random operations on rb and on a model of it, comparing the results.
+// cap is the buffer's size, preserve its policy for a full buffer.
+template<typename T, typename RB> void checkRing(RB &rb, size_t cap, bool preserve, uint32_t ops) {
+  std::deque<T> m;
+  std::vector<T> data(cap + 3);
+  T v;
+  for (uint32_t op = 0; op < ops; ++op) {
+    switch (checkRandom(16)) {
+    case 0:   // push_back, copied, moved or emplaced
+    case 1:
+    case 2: {
+      checkValue(v);
+      T keep = v;
+      uint32_t how = checkRandom(3);
+      bool ok = (how == 0) ? rb.push_back(v) : (how == 1) ? rb.push_back(std::move(v)) : rb.emplace_back(v);
+      if (m.size() < cap) {
+        CHECK(ok);
+        m.push_back(keep);
+      } else if (preserve) {
+        CHECK(!ok);
+      } else {
+        CHECK(ok);
+        m.pop_front();
+        m.push_back(keep);
+      }
+      break;
+    }
+    case 3: { // push_back a block, possibly larger than the buffer
+      size_t n = checkRandom(cap + 3);
+      for (size_t i = 0; i < n; ++i) checkValue(data[i]);
+      bool ok = rb.push_back(data.data(), n);
+      size_t room = cap - m.size();
+      if (n == 0 || (n > room && preserve)) {
+        CHECK(!ok);
+      } else {
+        CHECK(ok);
+        size_t skip = (n > cap) ? n - cap : 0;
+        for (size_t i = n - skip; i > room && !m.empty(); --i) m.pop_front();
+        m.insert(m.end(), data.begin() + skip, data.begin() + n);
+      }
+      break;
+    }
+    case 4: { // pop
+      size_t n = checkRandom(cap + 2);
+      size_t k = rb.pop(n);
+      CHECK(k == (n < m.size() ? n : m.size()));
+      m.erase(m.begin(), m.begin() + (k <= m.size() ? k : m.size()));
+      break;
+    }
+    case 5: { // pop_front
+      bool ok = rb.pop_front(v);
+      CHECK(ok == !m.empty());
+      if (ok && !m.empty()) {
+        CHECK(v == m.front());
+        m.pop_front();
+      }
+      break;
+    }
+    case 6: { // safeCopy, with or without move
+      size_t n = checkRandom(cap + 2);
+      bool move = checkRandom(2);
+      size_t k = rb.safeCopy(data.data(), n, move);
+      CHECK(k == (n < m.size() ? n : m.size()));
+      for (size_t i = 0; i < k && i < m.size(); ++i) CHECK(data[i] == m[i]);
+      if (move) m.erase(m.begin(), m.begin() + (k <= m.size() ? k : m.size()));
+      break;
+    }
+    case 7: { // reserve and commit
+      size_t n = checkRandom(cap + 2);
+      T *p = rb.reserve(n);
+      CHECK(n <= cap - m.size() && (n == 0) == (p == nullptr));
+      size_t k = n ? checkRandom(n + 1) : 0;
+      for (size_t i = 0; i < k; ++i) {
+        checkValue(p[i]);
+        m.push_back(p[i]);
+      }
+      CHECK(rb.commit(k));
+      CHECK(!rb.commit(cap - m.size() + 1));
+      break;
+    }
+    case 8: { // peekContiguous and consume
+      size_t len;
+      size_t skip = checkRandom(m.size() + 2);
+      const T *p = rb.peekContiguous(len, skip);
+      CHECK((skip >= m.size()) ? (!p && !len) : (p && len && len <= m.size() - skip));
+      for (size_t i = 0; p && i < len && skip + i < m.size(); ++i) CHECK(p[i] == m[skip + i]);
+      size_t k = rb.consume(checkRandom(m.size() + 1));
+      m.erase(m.begin(), m.begin() + (k <= m.size() ? k : m.size()));
+      break;
+    }
+    case 9: { // gather, with a sink taking part of the elements only
+      size_t room = checkRandom(m.size() + 2);
+      size_t got = 0;
+      bool same = true;
+      size_t k = rb.gather([&](const T *p, size_t len) -> size_t {
+        size_t take = (len < room - got) ? len : room - got;
+        for (size_t i = 0; i < take; ++i) {
+          if (got + i >= m.size() || !(p[i] == m[got + i])) same = false;
+        }
+        got += take;
+        return take;
+      });
+      CHECK(same && k == got && k <= m.size());
+      m.erase(m.begin(), m.begin() + (k <= m.size() ? k : m.size()));
+      break;
+    }
+    case 10: { // spans and data
+      typename RB::Span first, second;
+      size_t n = rb.spans(first, second);
+      CHECK(n == m.size() && first.size + second.size == n);
+      for (size_t i = 0; i < first.size && i < m.size(); ++i) CHECK(first.data[i] == m[i]);
+      for (size_t i = 0; i < second.size && first.size + i < m.size(); ++i) CHECK(second.data[i] == m[first.size + i]);
+      if (checkRandom(4) == 0) {
+        const T *p = rb.data();
+        size_t len = checkRotates(rb) ? m.size() : first.size;
+        for (size_t i = 0; i < len; ++i) CHECK(p[i] == m[i]);
+      }
+      break;
+    }
+    case 11: { // operator[], in and out of range
+      size_t i = checkRandom(cap + 2);
+      CHECK(rb[i] == ((i < m.size()) ? m[i] : T()));
+      break;
+    }
+    case 12: { // copies and moves
+      RB copy(rb);
+      CHECK(copy == rb);
+      RB other(cap, preserve);
+      other = copy;
+      CHECK(other == rb);
+      RB moved(std::move(copy));
+      CHECK(moved == rb);
+      other.clear();
+      other = std::move(moved);
+      CHECK(other == rb && checkEqual(other, m));
+      break;
+    }
+    case 13:  // drainTo
+      checkDrain(rb, m);
+      break;
+    case 14:  // clear, now and then
+      if (checkRandom(16) == 0) {
+        CHECK(rb.clear());
+        m.clear();
+      }
+      break;
+    default:  // Full comparison
+      CHECK(checkEqual(rb, m));
+      break;
+    }
+    CHECK(rb.size() == m.size() && rb.capacity() == cap - m.size() && rb.empty() == m.empty());
+  }
+  CHECK(checkEqual(rb, m));
+}
+
+// checkRingMode: a dynamic buffer of each size, preserving and overwriting.
+// RB_SPSC buffers are always preserving.
+template<typename T, RB_Mode MODE> void checkRingMode(const char *name) {
+  uint32_t failed = checkFailed;
+  const size_t sizes[] = { 1, 2, 3, 5, 16, 100, 255 };
+  for (size_t cap : sizes) {
+    for (int preserve = (MODE == RB_SPSC) ? 1 : 0; preserve < 2; ++preserve) {
+      RingBuf<T, MODE> rb(cap, preserve);
+      checkRing<T>(rb, cap, preserve, CHECK_OPS / 4);
+    }
+  }
+  checkDone(name, failed);
+}
+
+// checkRingStatic: static buffers of size N with both policies, and lock-free
+template<typename T, size_t N> void checkRingStatic() {
+  StaticRingBuf<T, N, RB_PRESERVE, RB_NOLOCK> rbp;
+  checkRing<T>(rbp, N, true, CHECK_OPS / 4);
+  StaticRingBuf<T, N, RB_OVERWRITE> rbo;
+  checkRing<T>(rbo, N, false, CHECK_OPS / 4);
+  StaticRingBuf<T, N, RB_PRESERVE, RB_SPSC> rbs;
+  checkRing<T>(rbs, N, true, CHECK_OPS / 4);
+}
+
+// checkSpsc: the zero-copy calls of an RB_SPSC buffer where its used area wraps around,
+// and on the host a producer and a consumer thread running concurrently
+void checkSpsc() {
+  uint32_t failed = checkFailed;
+  {
+    RingBuf<uint8_t, RB_SPSC> rb(5);
+    const uint8_t in[] = { 1, 2, 3, 4, 5, 6 };
+    uint8_t out[5];
+    size_t len;
+    // Move head and tail to index 3
+    CHECK(rb.push_back(in, 3) && rb.pop(3) == 3 && rb.empty());
+    // Four elements wrap: 3, 4 and 0, 1
+    CHECK(rb.push_back(in, 4) && rb.size() == 4);
+    CHECK(!rb.push_back(in, 2) && rb.size() == 4);
+    const uint8_t *p = rb.peekContiguous(len);
+    CHECK(p && len == 2 && p[0] == 1 && p[1] == 2);
+    p = rb.peekContiguous(len, 2);
+    CHECK(p && len == 2 && p[0] == 3 && p[1] == 4);
+    CHECK(rb.safeCopy(out, 5) == 4 && out[0] == 1 && out[3] == 4);
+    // data() does not rotate, so only the first run is contiguous
+    CHECK(rb.data() == rb.peekContiguous(len) && len == 2);
+    // One free slot left, behind the wrap
+    size_t n = 3;
+    uint8_t *r = rb.reserve(n);
+    CHECK(r && n == 1);
+    if (r) *r = 5;
+    CHECK(!rb.commit(2) && rb.commit(1) && rb.size() == 5);
+    n = 1;
+    CHECK(!rb.reserve(n) && n == 0);
+    // Consume across the wrap
+    CHECK(rb.consume(3) == 3);
+    p = rb.peekContiguous(len);
+    CHECK(p && len == 2 && p[0] == 4 && p[1] == 5);
+    // Three slots are free, but only two of them before the buffer end
+    n = 5;
+    r = rb.reserve(n);
+    CHECK(r && n == 2);
+    if (r) memcpy(r, in + 4, 2);
+    CHECK(rb.commit(2) && rb.size() == 4);
+    CHECK(rb.safeCopy(out, 5, true) == 4 && rb.empty());
+    CHECK(out[0] == 4 && out[1] == 5 && out[2] == 5 && out[3] == 6);
+    // clear() only moves head, tail stays where the producer left it
+    CHECK(rb.push_back(in, 2) && rb.clear() && rb.empty() && rb.capacity() == 5);
+  }
+#if !defined(ARDUINO)
+  {
+    // The producer pushes consecutive numbers in random ways, the consumer takes them in random ways.
+    // Every number must arrive once and in order.
+    const uint32_t COUNT(1000000);
+    RingBuf<uint32_t, RB_SPSC> rb(61);
+    std::atomic<bool> done(false);
+    std::thread producer([&]() {
+      uint32_t seed = 88172645u;
+      uint32_t next = 0;
+      uint32_t block[16];
+      while (next < COUNT) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        size_t n = 1 + seed % 16;
+        if (n > COUNT - next) n = COUNT - next;
+        bool ok = false;
+        switch (seed % 3) {
+        case 0:
+          ok = rb.push_back(next);
+          n = 1;
+          break;
+        case 1:
+          for (size_t i = 0; i < n; ++i) block[i] = next + i;
+          ok = rb.push_back(block, n);
+          break;
+        default: {
+          uint32_t *p = rb.reserve(n);
+          for (size_t i = 0; i < n; ++i) p[i] = next + i;
+          ok = p && rb.commit(n);
+          break;
+        }
+        }
+        if (ok) next += n;
+        else    std::this_thread::yield();
+      }
+      done = true;
+    });
+    uint32_t seed = 1234567u;
+    uint32_t expect = 0;
+    bool inOrder = true;
+    uint32_t block[16];
+    while (expect < COUNT && inOrder) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      size_t n = 0;
+      switch (seed % 3) {
+      case 0: {
+        uint32_t v;
+        if (rb.pop_front(v)) {
+          inOrder = (v == expect);
+          n = 1;
+        }
+        break;
+      }
+      case 1:
+        n = rb.safeCopy(block, 1 + seed % 16, true);
+        for (size_t i = 0; i < n; ++i) inOrder = inOrder && (block[i] == expect + i);
+        break;
+      default: {
+        const uint32_t *p = rb.peekContiguous(n);
+        for (size_t i = 0; i < n; ++i) inOrder = inOrder && (p[i] == expect + i);
+        rb.consume(n);
+        break;
+      }
+      }
+      if (n) expect += n;
+      else   std::this_thread::yield();
+    }
+    producer.join();
+    CHECK(inOrder);
+    CHECK(expect == COUNT && done && rb.empty());
+  }
+#endif
+  checkDone("RingBuf SPSC zero-copy and threads", failed);
+}
+
+// CapturePrint: keep what is written
+class CapturePrint : public Print {
+public:
+  size_t write(uint8_t c) { text += (char)c; return 1; }
+  size_t write(const uint8_t *buffer, size_t size) { text.append((const char *)buffer, size); return size; }
+  using Print::write;
+  std::string text;
+};
+
+// checkCommand: feed input to a TelnetCommand and compare the reply and the action
+void checkCommand(TelnetCommand &tc, const char *input, const char *reply, 
+                  TelnetCommand::Action action = TelnetCommand::TC_NONE, uint32_t arg = 0) {
+  CapturePrint out;
+  uint32_t a = 99;
+  size_t len = strlen(input);
+  size_t used = tc.feed((const uint8_t *)input, len);
+  CHECK(used == len && tc.ready());
+  CHECK(tc.execute(out, a) == action && a == arg);
+  if (out.text != reply) {
+    std::string line(input, strcspn(input, "\r\n"));
+    line = "reply to '" + line + "'";
+    checkFail(__LINE__, line.c_str());
+    if (checkFailed <= 10) checkOut->printf("    got '%s'\n", out.text.c_str());
+  }
+}
+
+void checkTelnetCommand() {
+  uint32_t failed = checkFailed;
+  int level = MBUlogLvl;
+  TelnetCommand tc;
+  checkCommand(tc, "level 3\n", "Log level is 3 (warning)\n");
+  CHECK(MBUlogLvl == 3);
+  checkCommand(tc, "level verbose\n", "Log level is 6 (verbose)\n");
+  checkCommand(tc, "level ERROR\n", "Log level is 2 (error)\n");
+  checkCommand(tc, "level\r\n", "Log level is 2 (error)\n");
+  // Level names are whole words only
+  checkCommand(tc, "level e\n", "Unknown level 'e'\nLog level is 2 (error)\n");
+  checkCommand(tc, "level eat\n", "Unknown level 'eat'\nLog level is 2 (error)\n");
+  checkCommand(tc, "level verbosity\n", "Unknown level 'verbosity'\nLog level is 2 (error)\n");
+  checkCommand(tc, "level 7\n", "Unknown level '7'\nLog level is 2 (error)\n");
+  checkCommand(tc, "level 12\n", "Unknown level '12'\nLog level is 2 (error)\n");
+  CHECK(MBUlogLvl == 2);
+  checkCommand(tc, "module\n", "Module name missing\n");
+  checkCommand(tc, "module checkmod debug\n", "Module checkmod level is 5 (debug)\n");
+  checkCommand(tc, "module checkmod d\n", "Unknown level 'd'\nModule checkmod level is 5 (debug)\n");
+  checkCommand(tc, "module checkmod off\n", "Module checkmod has no level\n");
+  checkCommand(tc, "pause\n", "Output paused\n");
+  CHECK(tc.paused());
+  checkCommand(tc, "resume\n", "Output resumed\n");
+  CHECK(!tc.paused());
+  checkCommand(tc, "history\n", "", TelnetCommand::TC_HISTORY, 0);
+  checkCommand(tc, "  history \t 500\n", "", TelnetCommand::TC_HISTORY, 500);
+  checkCommand(tc, "stats\n", "", TelnetCommand::TC_STATS);
+  checkCommand(tc, "\n", "");
+  checkCommand(tc, "bogus x\n", "Unknown command 'bogus' - try 'help'\n");
+  // Telnet negotiations are skipped: IAC WILL ECHO, IAC NOP
+  checkCommand(tc, "\xFF\xFB\x01lev\xFF\xF1" "el 4\n", "Log level is 4 (info)\n");
+  // Too long
+  std::string longLine(TC_LINELEN + 5, 'x');
+  longLine += '\n';
+  checkCommand(tc, longLine.c_str(), "Line too long (max. 63 characters)\n");
+  // Two lines in one go: feed() stops at the end of the first
+  const char *two = "pause\nresume\n";
+  CHECK(tc.feed((const uint8_t *)two, strlen(two)) == 6 && tc.ready());
+  CapturePrint out;
+  uint32_t arg;
+  tc.execute(out, arg);
+  CHECK(tc.paused());
+  checkCommand(tc, two + 6, "Output resumed\n");
+  // Byte by byte
+  const char *slow = "level 1\n";
+  for (const char *cp = slow; *cp; ++cp) CHECK(tc.feed((const uint8_t *)cp, 1) == 1);
+  CHECK(tc.ready() && tc.execute(out, arg) == TelnetCommand::TC_NONE && MBUlogLvl == 1);
+  MBUlogLvl = level;
+  checkDone("TelnetCommand", failed);
+}
+
+#if !defined(ARDUINO)
+// Scheduler check: tasks with different periods, serviced across the millis() wrap-around
+struct CheckTask {
+  uint32_t period;        // Interval to the next service
+  uint32_t due;           // Time the task asked for
+  uint32_t runs;          // Number of services
+  bool late;              // Serviced after its time
+  bool early;             // Serviced before its time
+};
+
+uint32_t checkTaskRun(void *arg) {
+  CheckTask *t = static_cast<CheckTask *>(arg);
+  uint32_t now = Tick::now();
+  if (t->runs) {
+    if ((int32_t)(now - t->due) > 0) t->late = true;
+    if ((int32_t)(now - t->due) < 0) t->early = true;
+  }
+  t->runs++;
+  t->due = now + t->period;
+  return t->due;
+}
+
+void checkScheduler() {
+  uint32_t failed = checkFailed;
+  benchFakeClock = true;
+  // Start 3 seconds before millis() wraps around
+  benchFakeUs = ((uint64_t)1 << 32) * 1000 - 3000000;
+  Tick::update();
+  uint64_t start = Tick::now64();
+  Scheduler sc(100);
+  CheckTask task[] = { { 1, 0, 0, false, false }, { 7, 0, 0, false, false }, 
+                       { 50, 0, 0, false, false }, { 99, 0, 0, false, false } };
+  for (CheckTask &t : task) CHECK(sc.add(checkTaskRun, &t) >= 0);
+  uint64_t last = start;
+  const uint32_t duration = 6000;
+  for (uint32_t ms = 0; ms < duration; ++ms) {
+    uint32_t wait = sc.run();
+    CHECK(wait >= 1 && wait <= 100);
+    // The 64 bit time runs on while the 32 bit one wraps
+    CHECK(Tick::now64() == last + (ms ? 1 : 0) && (uint32_t)Tick::now64() == Tick::now());
+    CHECK(Tick::nowUs() == benchFakeUs && Tick::now64() == Tick::nowUs() / 1000);
+    last = Tick::now64();
+    benchFakeUs += 1000;
+  }
+  CHECK(last >> 32 == 1 && Tick::now() < 3000);
+  for (CheckTask &t : task) {
+    CHECK(!t.late && !t.early);
+    CHECK(t.runs == (duration - 1) / t.period + 1);
+  }
+  // A woken task is run with the next run(), even across the wrap
+  benchFakeUs = ((uint64_t)2 << 32) * 1000 - 500;
+  Tick::update();
+  uint32_t runs = task[3].runs;
+  task[3].runs = 0;
+  sc.wake(3);
+  benchFakeUs += 1000;
+  sc.run();
+  CHECK(task[3].runs == 1);
+  task[3].runs += runs;
+  benchFakeClock = false;
+  Tick::update();
+  checkDone("Scheduler and Tick wrap-around", failed);
+}
+#endif
+
+#if defined(LOG_DEFERRED) && !defined(ARDUINO)
+// checkDeferred: several tasks storing deferred records while another one is draining them.
+// Every record must come out complete and in the order of its task, or be counted as lost.
+void checkDeferred() {
+  const uint32_t TASKS(4);
+  const uint32_t RECORDS(20000);
+  uint32_t failed = checkFailed;
+  uint32_t lostBefore = logLost();
+  CapturePrint out;
+  std::atomic<uint32_t> running(TASKS);
+  std::atomic<bool> go(false);
+  std::thread drain([&]() {
+    while (running) logDrain(&out);
+    logDrain(&out);
+  });
+  std::vector<std::thread> tasks;
+  for (uint32_t t = 0; t < TASKS; ++t) {
+    tasks.emplace_back([&, t]() {
+      // All start at once, to have them collide
+      while (!go) std::this_thread::yield();
+      for (uint32_t i = 0; i < RECORDS; ++i) logDeferred(LOG_LEVEL_INFO, "%u %u\n", t, i);
+      running--;
+    });
+  }
+  go = true;
+  for (auto &task : tasks) task.join();
+  drain.join();
+  uint32_t next[TASKS] = { 0 };
+  uint32_t lines = 0;
+  const char *cp = out.text.c_str();
+  while (*cp) {
+    const char *eol = strchr(cp, '\n');
+    if (!eol) break;
+    unsigned int t, i;
+    int len = 0;
+    // Skip the lost records reports
+    if (*cp != '[') {
+      bool ok = sscanf(cp, "%u %u%n", &t, &i, &len) == 2 && cp + len == eol && t < TASKS && i >= next[t];
+      CHECK(ok);
+      if (ok) next[t] = i + 1;
+      lines++;
+    }
+    cp = eol + 1;
+  }
+  CHECK(*cp == 0);
+  CHECK(lines + (logLost() - lostBefore) == TASKS * RECORDS);
+  checkDone("Deferred logging, 4 writers", failed);
+}
+#endif
+
+// checkAll: run all checks. Returns the number of failures.
+uint32_t checkAll(Print &out) {
+  checkOut = &out;
+  checkFailed = 0;
+  out.println("--- Checks");
+  checkRingMode<uint8_t, RB_NOLOCK>("RingBuf<uint8_t> NOLOCK");
+  checkRingMode<uint8_t, RB_LOCKED>("RingBuf<uint8_t> LOCKED");
+  checkRingMode<std::string, RB_NOLOCK>("RingBuf<std::string> NOLOCK");
+  checkRingMode<std::string, RB_LOCKED>("RingBuf<std::string> LOCKED");
+  checkRingMode<uint8_t, RB_SPSC>("RingBuf<uint8_t> SPSC");
+  checkRingMode<std::string, RB_SPSC>("RingBuf<std::string> SPSC");
+  checkSpsc();
+  uint32_t failed = checkFailed;
+  checkRingStatic<uint8_t, 1>();
+  checkRingStatic<uint8_t, 7>();
+  checkRingStatic<uint8_t, 255>();
+  checkRingStatic<std::string, 7>();
+  checkRingStatic<std::string, 64>();
+  checkDone("StaticRingBuf", failed);
+  checkTelnetCommand();
+#if !defined(ARDUINO)
+  checkScheduler();
+#endif
+#if defined(LOG_DEFERRED) && !defined(ARDUINO)
+  checkDeferred();
+#endif
+  if (checkFailed) out.printf("%u checks FAILED\n", (unsigned)checkFailed);
+  return checkFailed;
+}
+
+void benchAll(Print &out) {
+  NullPrint null;
+  for (size_t i = 0; i < BLOCK; ++i) block[i] = i;
+
+  out.println("--- RingBuf");
+  {
+    RingBuf<uint8_t, RB_NOLOCK> rb(1024, true);
+    benchRing(out, "NOLOCK", rb);
+  }
+  {
+    RingBuf<uint8_t> rb(1024, true);
+    benchRing(out, "LOCKED", rb);
+  }
+  {
+    StaticRingBuf<uint8_t, 1024, RB_PRESERVE, RB_NOLOCK> rb;
+    benchRing(out, "static NOLOCK", rb);
+  }
+  {
+    RingBuf<uint8_t, RB_NOLOCK> rb(1024);
+    benchOverwrite(out, "NOLOCK", rb);
+  }
+  {
+    RingBuf<uint8_t> rb(1024);
+    benchOverwrite(out, "LOCKED", rb);
+  }
+
+  out.println("--- Logging");
+  Print *device = LOGDEVICE;
+  int level = MBUlogLvl;
+  LOGDEVICE = &null;
+  MBUlogLvl = LOG_LEVEL_NONE;
+  bench(out, "LOG_D suppressed", BENCH_OPS, 0, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) LOG_D("value %u\n", i);
+  });
+  MBUlogLvl = LOG_LEVEL_VERBOSE;
+#ifdef LOG_DEFERRED
+  // Only as many records are stored as fit into the binary log buffer. These are drained afterwards.
+  logDrain(&null);
+  uint32_t lost = logLost();
+  bench(out, "LOG_D deferred", LOG_DEFERRED_SIZE / 16, 0, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) LOG_D("value %u\n", i);
+  });
+  if (logLost() != lost) out.println("  deferred records lost!");
+  bench(out, "LOG_D deferred + logDrain()", LOG_DEFERRED_SIZE / 16, 0, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) LOG_D("value %u\n", i);
+    logDrain(&null);
+  });
+#else
+  LOG_D("value %u\n", 0);
+  size_t lineLen = null.count;
+  bench(out, "LOG_D printed", BENCH_OPS / 10, lineLen, [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) LOG_D("value %u\n", i);
+  });
+#endif
+  uint8_t data[256];
+  for (size_t i = 0; i < sizeof(data); ++i) data[i] = i;
+  bench(out, "logHexDump(256)", BENCH_OPS / 100, sizeof(data), [&](uint32_t ops) {
+    for (uint32_t i = 0; i < ops; ++i) logHexDump(&null, "D", "bench", data, sizeof(data));
+  });
+  LOGDEVICE = device;
+  MBUlogLvl = level;
+
+#if !defined(ARDUINO)
+  out.println("--- TelnetLogAsync");
+  benchFanout(out, 1);
+  benchFanout(out, 4);
+#endif
+}
+
+#if defined(ARDUINO)
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  checkAll(Serial);
+  benchAll(Serial);
+}
+
+void loop() {
+  delay(1000);
+}
+#else
+int main() {
+  // Failed checks fail the run, no need to benchmark then
+  if (checkAll(Serial)) return 1;
+  benchAll(Serial);
+  return 0;
+}
+#endif
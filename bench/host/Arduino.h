@@ -0,0 +1,99 @@
+// Host shim: the parts of the Arduino core the benchmarks need
+// Copyright 2020 by miq1@gmx.de
+//
+// Only meant for bench/bench.cpp - the WiFi and TCP classes do nothing but count.
+// 
+#ifndef _BENCH_ARDUINO_H
+#define _BENCH_ARDUINO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 3
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define __NOINIT_ATTR
+
+// The clock: the steady clock, or a simulated one set by the checks if benchFakeClock is true.
+// millis() and micros() are cut to 32 bits, so they wrap around like on the device.
+extern bool benchFakeClock;
+extern uint64_t benchFakeUs;
+inline uint64_t benchClockUs() {
+  using namespace std::chrono;
+  if (benchFakeClock) return benchFakeUs;
+  return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+inline unsigned long millis() { return (uint32_t)(benchClockUs() / 1000); }
+inline unsigned long micros() { return (uint32_t)benchClockUs(); }
+inline void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() {}
+
+// FreeRTOS critical sections, a plain spinlock here
+struct portMUX_TYPE { std::atomic_flag flag; };
+#define portMUX_INITIALIZER_UNLOCKED { ATOMIC_FLAG_INIT }
+inline void portENTER_CRITICAL(portMUX_TYPE *m) { while (m->flag.test_and_set(std::memory_order_acquire)) {} }
+inline void portEXIT_CRITICAL(portMUX_TYPE *m) { m->flag.clear(std::memory_order_release); }
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    if ((size_t)n >= sizeof(buf)) n = sizeof(buf) - 1;
+    return write((const uint8_t *)buf, n);
+  }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned long v) { char b[24]; snprintf(b, sizeof(b), "%lu", v); return write(b); }
+  size_t print(long v) { char b[24]; snprintf(b, sizeof(b), "%ld", v); return write(b); }
+  size_t print(int v) { return print((long)v); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+  size_t println() { return write("\r\n"); }
+  size_t println(const char *s) { return print(s) + println(); }
+  size_t println(unsigned long v) { return print(v) + println(); }
+  size_t println(long v) { return print(v) + println(); }
+  size_t println(int v) { return print(v) + println(); }
+  size_t println(unsigned int v) { return print(v) + println(); }
+};
+
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+  size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+  using Print::write;
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 100000; }
+};
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,68 @@
+// Host shim: an AsyncClient that takes everything and acknowledges on request
+#ifndef _BENCH_ASYNCTCP_H
+#define _BENCH_ASYNCTCP_H
+#include "Arduino.h"
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+
+class AsyncClient;
+typedef void (*AcConnectHandler)(void *, AsyncClient *);
+typedef void (*AcAckHandler)(void *, AsyncClient *, size_t, uint32_t);
+typedef void (*AcDataHandler)(void *, AsyncClient *, void *, size_t);
+
+class AsyncClient {
+public:
+  AsyncClient() : 
+    C_space(5744), C_inflight(0), C_total(0), C_connected(true),
+    C_ack(nullptr), C_ackArg(nullptr) {}
+  bool connected() { return C_connected; }
+  bool canSend() { return C_space > 0; }
+  size_t space() { return C_space; }
+  size_t add(const char *data, size_t size, uint8_t = ASYNC_WRITE_FLAG_COPY) {
+    (void)data;
+    if (size > C_space) size = C_space;
+    C_space -= size;
+    C_inflight += size;
+    C_total += size;
+    return size;
+  }
+  bool send() { return true; }
+  size_t write(const char *data, size_t size, uint8_t flags = ASYNC_WRITE_FLAG_COPY) { size = add(data, size, flags); send(); return size; }
+  void close(bool = false) { C_connected = false; }
+  void stop() { C_connected = false; }
+  void onDisconnect(AcConnectHandler, void * = nullptr) {}
+  void onPoll(AcConnectHandler, void * = nullptr) {}
+  void onData(AcDataHandler, void * = nullptr) {}
+  void onAck(AcAckHandler cb, void *arg = nullptr) { C_ack = cb; C_ackArg = arg; }
+  // ackAll: acknowledge all data sent so far
+  void ackAll() {
+    size_t n = C_inflight;
+    C_inflight = 0;
+    C_space += n;
+    if (C_ack && n) C_ack(C_ackArg, this, n, 1);
+  }
+  size_t total() const { return C_total; }
+protected:
+  size_t C_space;
+  size_t C_inflight;
+  size_t C_total;
+  bool C_connected;
+  AcAckHandler C_ack;
+  void *C_ackArg;
+};
+
+class AsyncServer {
+public:
+  explicit AsyncServer(uint16_t) : S_cb(nullptr), S_arg(nullptr) {}
+  void onClient(AcConnectHandler cb, void *arg) { S_cb = cb; S_arg = arg; }
+  void begin() {}
+  void end() {}
+  void setNoDelay(bool) {}
+  // connect: have a new client arrive
+  void connect(AsyncClient *client) { if (S_cb) S_cb(S_arg, client); }
+protected:
+  AcConnectHandler S_cb;
+  void *S_arg;
+};
+
+#endif
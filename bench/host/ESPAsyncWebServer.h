@@ -0,0 +1 @@
+// Host shim: nothing used from here
@@ -0,0 +1,16 @@
+// Host shim: a Ticker that never fires. The benchmarks flush explicitly.
+#ifndef _BENCH_TICKER_H
+#define _BENCH_TICKER_H
+#include "Arduino.h"
+
+class Ticker {
+public:
+  Ticker() : T_active(false) {}
+  template<typename TArg> void once_ms(uint32_t, void (*)(TArg), TArg) { T_active = true; }
+  void detach() { T_active = false; }
+  bool active() const { return T_active; }
+protected:
+  bool T_active;
+};
+
+#endif
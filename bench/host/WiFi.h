@@ -0,0 +1,17 @@
+// Host shim: WiFi as far as TelnetLogAsync needs it
+#ifndef _BENCH_WIFI_H
+#define _BENCH_WIFI_H
+#include "Arduino.h"
+
+class IPAddress {
+public:
+  uint8_t operator[](int i) const { static const uint8_t ip[4] = { 192, 168, 0, 1 }; return ip[i & 3]; }
+};
+
+class WiFiClass {
+public:
+  IPAddress localIP() { return IPAddress(); }
+};
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,8 @@
+// Host shim: the ESP32 64 bit timer, as used by Tick
+#ifndef _BENCH_ESP_TIMER_H
+#define _BENCH_ESP_TIMER_H
+#include "Arduino.h"
+
+inline int64_t esp_timer_get_time() { return (int64_t)benchClockUs(); }
+
+#endif
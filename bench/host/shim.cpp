@@ -0,0 +1,9 @@
+// Host shim: global objects
+#include "Arduino.h"
+#include "WiFi.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+bool benchFakeClock = false;
+uint64_t benchFakeUs = 0;
@@ -9,6 +9,7 @@
 #include "SSD1306AsciiWire.h"
 #include "TelnetLogAsync.h"
 #include "Logging.h"
+#include "Scheduler.h"
 
 // 0X3C+SA0 - 0x3C or 0x3D
 #define I2C_ADDRESS 0x3C
@@ -35,6 +36,8 @@ SSD1306AsciiWire oled;
 
 TelnetLog tl(23, 4);
 
+Scheduler sched;
+
 void setup() {
   Serial.begin(115200);
   Serial.println("\n");
@@ -73,6 +76,11 @@ void setup() {
   tl.begin("Bridge-Test");
   // LOGDEVICE = &tl;
   MBUlogLvl = LOG_LEVEL_VERBOSE;
+
+  sched.add(rot);
+  sched.add(gruen);
+  sched.add(ButtonA);
+  sched.add(ButtonB);
 }
 
 void loop() {
@@ -80,15 +88,15 @@ void loop() {
   static bool dOn = false;
   static unsigned int oldClientNum = 999;
   char buffer[64];
-  rot.update();
-  gruen.update();
+  // Service the LEDs and buttons when they are due
+  uint32_t idle = sched.run();
 
   if (oldClientNum != tl.getActiveClients()) {
     oldClientNum = tl.getActiveClients();
     Serial.printf("%d clients.\n", oldClientNum);
   }
 
-  if (ButtonA.update() > 0) {
+  if (ButtonA.qSize() > 0) {
     if (!dOn) oled.ssd1306WriteCmd(SSD1306_DISPLAYON);
     dOn = true;
     dTimer = millis();
@@ -113,7 +121,7 @@ void loop() {
     HEXDUMP_V("Buffer", (uint8_t *)buffer, strlen(buffer));
   }
   
-  if (ButtonB.update() > 0) {
+  if (ButtonB.qSize() > 0) {
     if (!dOn) oled.ssd1306WriteCmd(SSD1306_DISPLAYON);
     dOn = true;
     dTimer = millis();
@@ -141,5 +149,8 @@ void loop() {
     oled.ssd1306WriteCmd(SSD1306_DISPLAYOFF);
     dOn = false;
   }
+
+  // Idle until something is due again
+  delay(idle);
 }
 